@@ -0,0 +1,17 @@
+#pragma once
+
+#include <new>
+
+// Cache-line (64-byte) aligned arrays, which also suits every SIMD width in
+// use. Free with free_aligned; null is fine.
+template <typename T>
+T* alloc_aligned(int n)
+{
+    return (T*) ::operator new[](sizeof(T) * n, std::align_val_t(64));
+}
+
+template <typename T>
+void free_aligned(T* p)
+{
+    ::operator delete[](p, std::align_val_t(64));
+}
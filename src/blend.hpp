@@ -0,0 +1,369 @@
+#pragma once
+
+#include <cstring>
+#include <iostream>
+
+#include "cpu.hpp"
+#include "rng.hpp"
+
+// Per-pixel blends of 0xAABBGGRR colours; the result is always opaque.
+
+unsigned int blend_avg(int source, int target)
+{
+    unsigned int sourcer = ((unsigned int) source >> 0) & 0xff;
+    unsigned int sourceg = ((unsigned int) source >> 8) & 0xff;
+    unsigned int sourceb = ((unsigned int) source >> 16) & 0xff;
+    unsigned int targetr = ((unsigned int) target >> 0) & 0xff;
+    unsigned int targetg = ((unsigned int) target >> 8) & 0xff;
+    unsigned int targetb = ((unsigned int) target >> 16) & 0xff;
+
+    targetr = (sourcer + targetr) / 2;
+    targetg = (sourceg + targetg) / 2;
+    targetb = (sourceb + targetb) / 2;
+
+    return (targetr << 0) | (targetg << 8) | (targetb << 16) | 0xff000000;
+}
+
+unsigned int blend_mul(int source, int target)
+{
+    unsigned int sourcer = ((unsigned int) source >> 0) & 0xff;
+    unsigned int sourceg = ((unsigned int) source >> 8) & 0xff;
+    unsigned int sourceb = ((unsigned int) source >> 16) & 0xff;
+    unsigned int targetr = ((unsigned int) target >> 0) & 0xff;
+    unsigned int targetg = ((unsigned int) target >> 8) & 0xff;
+    unsigned int targetb = ((unsigned int) target >> 16) & 0xff;
+
+    targetr = (sourcer * targetr) >> 8;
+    targetg = (sourceg * targetg) >> 8;
+    targetb = (sourceb * targetb) >> 8;
+
+    return (targetr << 0) | (targetg << 8) | (targetb << 16) | 0xff000000;
+}
+
+unsigned int blend_add(int source, int target)
+{
+    unsigned int sourcer = ((unsigned int) source >> 0) & 0xff;
+    unsigned int sourceg = ((unsigned int) source >> 8) & 0xff;
+    unsigned int sourceb = ((unsigned int) source >> 16) & 0xff;
+    unsigned int targetr = ((unsigned int) target >> 0) & 0xff;
+    unsigned int targetg = ((unsigned int) target >> 8) & 0xff;
+    unsigned int targetb = ((unsigned int) target >> 16) & 0xff;
+
+    targetr += sourcer;
+    targetg += sourceg;
+    targetb += sourceb;
+
+    if (targetr > 0xff)
+        targetr = 0xff;
+    if (targetg > 0xff)
+        targetg = 0xff;
+    if (targetb > 0xff)
+        targetb = 0xff;
+
+    return (targetr << 0) | (targetg << 8) | (targetb << 16) | 0xff000000;
+}
+
+// Blend policies: how a drawn colour combines with what is already in the
+// framebuffer. Rasterizers take one as a template parameter, so the blend is
+// inlined into their inner loop and every rasterizer gets every mode.
+// apply() is the per-pixel blend; sse2() and avx2() do the same to 4 and 8
+// pixels at once with saturating 8-bit adds and 16-bit multiplies, and give
+// bit-identical results. Which one runs is picked at runtime (see cpu.hpp).
+struct BlendReplace
+{
+    static int apply(int, int src) { return src; }
+#if defined(CPU_HAVE_SSE2)
+    static __m128i sse2(__m128i, __m128i src) { return src; }
+#endif
+#if defined(CPU_HAVE_AVX2)
+    TARGET_AVX2 static __m256i avx2(__m256i, __m256i src) { return src; }
+#endif
+};
+
+struct BlendAdd
+{
+    static int apply(int dst, int src) { return (int) blend_add(src, dst); }
+#if defined(CPU_HAVE_SSE2)
+    static __m128i sse2(__m128i dst, __m128i src)
+    {
+        return _mm_or_si128(_mm_adds_epu8(dst, src), _mm_set1_epi32((int) 0xff000000));
+    }
+#endif
+#if defined(CPU_HAVE_AVX2)
+    TARGET_AVX2 static __m256i avx2(__m256i dst, __m256i src)
+    {
+        return _mm256_or_si256(_mm256_adds_epu8(dst, src), _mm256_set1_epi32((int) 0xff000000));
+    }
+#endif
+};
+
+struct BlendMul
+{
+    static int apply(int dst, int src) { return (int) blend_mul(src, dst); }
+#if defined(CPU_HAVE_SSE2)
+    static __m128i sse2(__m128i dst, __m128i src)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(src, zero));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(src, zero));
+        __m128i px = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        return _mm_or_si128(px, _mm_set1_epi32((int) 0xff000000));
+    }
+#endif
+#if defined(CPU_HAVE_AVX2)
+    TARGET_AVX2 static __m256i avx2(__m256i dst, __m256i src)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i lo =
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), _mm256_unpacklo_epi8(src, zero));
+        __m256i hi =
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), _mm256_unpackhi_epi8(src, zero));
+        __m256i px = _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+        return _mm256_or_si256(px, _mm256_set1_epi32((int) 0xff000000));
+    }
+#endif
+};
+
+// (a + b) / 2 rounding down, per byte: (a & b) + ((a ^ b) >> 1). The shift
+// is done on 16-bit lanes, so the bit shifted in from the neighbouring byte
+// is masked off.
+struct BlendAvg
+{
+    static int apply(int dst, int src) { return (int) blend_avg(src, dst); }
+#if defined(CPU_HAVE_SSE2)
+    static __m128i sse2(__m128i dst, __m128i src)
+    {
+        __m128i half = _mm_and_si128(_mm_srli_epi16(_mm_xor_si128(dst, src), 1), _mm_set1_epi8(0x7f));
+        __m128i px = _mm_add_epi8(_mm_and_si128(dst, src), half);
+        return _mm_or_si128(px, _mm_set1_epi32((int) 0xff000000));
+    }
+#endif
+#if defined(CPU_HAVE_AVX2)
+    TARGET_AVX2 static __m256i avx2(__m256i dst, __m256i src)
+    {
+        __m256i half =
+            _mm256_and_si256(_mm256_srli_epi16(_mm256_xor_si256(dst, src), 1), _mm256_set1_epi8(0x7f));
+        __m256i px = _mm256_add_epi8(_mm256_and_si256(dst, src), half);
+        return _mm256_or_si256(px, _mm256_set1_epi32((int) 0xff000000));
+    }
+#endif
+};
+
+// dst[i] = blend(dst[i], src[i])
+template <typename Blend>
+void blend_span_scalar(int* dst, const int* src, int n)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] = Blend::apply(dst[i], src[i]);
+}
+
+// dst[i] = blend(dst[i], c); n may be zero or negative
+template <typename Blend>
+void blend_fill_scalar(int* dst, int c, int n)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] = Blend::apply(dst[i], c);
+}
+
+#if defined(CPU_HAVE_SSE2)
+template <typename Blend>
+void blend_span_sse2(int* dst, const int* src, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), Blend::sse2(d, s));
+    }
+    blend_span_scalar<Blend>(dst + i, src + i, n - i);
+}
+
+template <typename Blend>
+void blend_fill_sse2(int* dst, int c, int n)
+{
+    const __m128i c4 = _mm_set1_epi32(c);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+        _mm_storeu_si128((__m128i*) (dst + i), Blend::sse2(d, c4));
+    }
+    blend_fill_scalar<Blend>(dst + i, c, n - i);
+}
+#endif
+
+#if defined(CPU_HAVE_AVX2)
+template <typename Blend>
+TARGET_AVX2 void blend_span_avx2(int* dst, const int* src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), Blend::avx2(d, s));
+    }
+    // the 4-wide kernel takes what is left, the scalar one the rest
+    blend_span_sse2<Blend>(dst + i, src + i, n - i);
+}
+
+template <typename Blend>
+TARGET_AVX2 void blend_fill_avx2(int* dst, int c, int n)
+{
+    const __m256i c8 = _mm256_set1_epi32(c);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), Blend::avx2(d, c8));
+    }
+    blend_fill_sse2<Blend>(dst + i, c, n - i);
+}
+#endif
+
+template <typename Blend>
+void blend_span(int* dst, const int* src, int n)
+{
+    switch (gCpuTier)
+    {
+#if defined(CPU_HAVE_AVX2)
+    case TIER_AVX2:
+        return blend_span_avx2<Blend>(dst, src, n);
+#endif
+#if defined(CPU_HAVE_SSE2)
+    case TIER_SSE2:
+        return blend_span_sse2<Blend>(dst, src, n);
+#endif
+    default:
+        return blend_span_scalar<Blend>(dst, src, n);
+    }
+}
+
+template <typename Blend>
+void blend_fill(int* dst, int c, int n)
+{
+    switch (gCpuTier)
+    {
+#if defined(CPU_HAVE_AVX2)
+    case TIER_AVX2:
+        return blend_fill_avx2<Blend>(dst, c, n);
+#endif
+#if defined(CPU_HAVE_SSE2)
+    case TIER_SSE2:
+        return blend_fill_sse2<Blend>(dst, c, n);
+#endif
+    default:
+        return blend_fill_scalar<Blend>(dst, c, n);
+    }
+}
+
+// blend_fill of the pixels dst[j], j < n, whose bit j is set in bits.
+// The SSE2 kernel blends groups of 4 and selects per lane, skipping empty
+// groups; unselected pixels are written back unchanged, so dst[0 .. n) must
+// all belong to the caller.
+template <typename Blend>
+void blend_fill_masked_scalar(int* dst, int c, unsigned int bits, int n)
+{
+    for (int j = 0; j < n; j++)
+        if (bits & (1u << j))
+            dst[j] = Blend::apply(dst[j], c);
+}
+
+#if defined(CPU_HAVE_SSE2)
+template <typename Blend>
+void blend_fill_masked_sse2(int* dst, int c, unsigned int bits, int n)
+{
+    const __m128i c4 = _mm_set1_epi32(c);
+    const __m128i lane = _mm_setr_epi32(1, 2, 4, 8);
+    int j = 0;
+    for (; j + 4 <= n; j += 4, bits >>= 4)
+    {
+        if (!(bits & 0xf))
+            continue;
+        __m128i m = _mm_and_si128(_mm_set1_epi32((int) bits), lane);
+        m = _mm_cmpeq_epi32(m, lane);
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + j));
+        __m128i px = _mm_or_si128(_mm_and_si128(m, Blend::sse2(d, c4)), _mm_andnot_si128(m, d));
+        _mm_storeu_si128((__m128i*) (dst + j), px);
+    }
+    blend_fill_masked_scalar<Blend>(dst + j, c, bits, n - j);
+}
+#endif
+
+template <typename Blend>
+void blend_fill_masked(int* dst, int c, unsigned int bits, int n)
+{
+#if defined(CPU_HAVE_SSE2)
+    if (gCpuTier >= TIER_SSE2)
+        return blend_fill_masked_sse2<Blend>(dst, c, bits, n);
+#endif
+    blend_fill_masked_scalar<Blend>(dst, c, bits, n);
+}
+
+// Runs the selected tier's span, fill and masked fill kernels and the scalar
+// reference over the same random pixels and compares the results bit for
+// bit. Spans start one pixel in, so the vector loads are unaligned.
+template <typename Blend>
+bool blend_matches_scalar()
+{
+    constexpr int n = SELFTEST_COUNT;
+    int src[n], a[n + 1], b[n + 1];
+    Rng rng(1);
+    for (int i = 0; i < n; i++)
+        src[i] = (int) rng.next_u32();
+    for (int i = 0; i <= n; i++)
+        a[i] = b[i] = (int) rng.next_u32();
+    const int c = (int) rng.next_u32();
+
+    blend_span<Blend>(a + 1, src, n);
+    blend_span_scalar<Blend>(b + 1, src, n);
+    blend_fill<Blend>(a + 1, c, n);
+    blend_fill_scalar<Blend>(b + 1, c, n);
+    // Masked fills of every width up to 32, one after another
+    for (int w = 1, at = 1; w <= 32; at += w, w++)
+    {
+        const unsigned int bits = rng.next_u32();
+        blend_fill_masked<Blend>(a + at, c, bits, w);
+        blend_fill_masked_scalar<Blend>(b + at, c, bits, w);
+    }
+    return memcmp(a, b, sizeof(a)) == 0;
+}
+
+bool blend_selftest()
+{
+    bool ok = for_each_supported_tier("blend<replace>", blend_matches_scalar<BlendReplace>);
+    ok &= for_each_supported_tier("blend<add>", blend_matches_scalar<BlendAdd>);
+    ok &= for_each_supported_tier("blend<mul>", blend_matches_scalar<BlendMul>);
+    ok &= for_each_supported_tier("blend<avg>", blend_matches_scalar<BlendAvg>);
+    return ok;
+}
+
+// Blend::apply(dst, c) over dst at partial coverage, cover / 256 of the
+// blended colour; for anti-aliased edges. Red and blue are interpolated
+// together in one multiply, green in another.
+template <typename Blend>
+int blend_cover(int dst, int c, int cover)
+{
+    const unsigned int d = (unsigned int) dst;
+    const unsigned int s = (unsigned int) Blend::apply(dst, c);
+    const unsigned int keep = 256 - cover;
+    unsigned int rb = ((d & 0xff00ff) * keep + (s & 0xff00ff) * cover) >> 8;
+    unsigned int g = ((d & 0x00ff00) * keep + (s & 0x00ff00) * cover) >> 8;
+    return (int) ((rb & 0xff00ff) | (g & 0x00ff00) | 0xff000000);
+}
+
+void blend_add_span(int* dst, const int* src, int n)
+{
+    blend_span<BlendAdd>(dst, src, n);
+}
+
+void blend_mul_span(int* dst, const int* src, int n)
+{
+    blend_span<BlendMul>(dst, src, n);
+}
+
+void blend_avg_span(int* dst, const int* src, int n)
+{
+    blend_span<BlendAvg>(dst, src, n);
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "blend.hpp"
+#include "rng.hpp"
+#include "tiles.hpp"
+
+// Rows [i0, i1) and columns [j0, j1) of a w x h source with its top left
+// corner at (x, y) that lie inside clip. Every blitter clips through this
+// once and then walks the visible part without bounds checks.
+struct BlitRect
+{
+    int i0, i1, j0, j1;
+
+    bool empty() const { return i0 >= i1 || j0 >= j1; }
+};
+
+BlitRect blit_rect(const ClipRect& clip, int x, int y, int w, int h)
+{
+    return { std::max(0, clip.y0 - y),
+             std::min(h, clip.y1 - y),
+             std::max(0, clip.x0 - x),
+             std::min(w, clip.x1 - x) };
+}
+
+// W x H byte mask compiled at build time: constexpr CompiledMask<16, 16>
+// m(mask) bakes each row into the binary twice, as a bitmask and as the runs
+// of set pixels, so drawing never looks at the mask.
+template <int W, int H>
+struct CompiledMask
+{
+    static_assert(W <= 32, "rows are stored as 32-bit masks");
+
+    struct Span
+    {
+        unsigned char x, len;
+    };
+    // Bit j of bits[i] is mask[i * W + j] != 0
+    unsigned int bits[H] = {};
+    // A row has at most (W + 1) / 2 runs
+    Span spans[H][(W + 1) / 2] = {};
+    unsigned char count[H] = {};
+
+    constexpr explicit CompiledMask(const unsigned char (&mask)[W * H])
+    {
+        for (int i = 0; i < H; i++)
+            for (int j = 0; j < W;)
+            {
+                if (!mask[i * W + j])
+                {
+                    j++;
+                    continue;
+                }
+                int end = j;
+                while (end < W && mask[i * W + end])
+                    end++;
+                bits[i] |= (end - j == 32 ? ~0u : (1u << (end - j)) - 1) << j;
+                spans[i][count[i]++] = { (unsigned char) j, (unsigned char) (end - j) };
+                j = end;
+            }
+    }
+};
+
+// Compiled mask with its top left corner at (x, y), filled with c using
+// Blend. Rows entirely inside the clip rect go through the masked fill
+// kernel a row at a time; a mask cut off at the left or right falls back to
+// filling the runs, so nothing outside the clip rect is touched.
+template <typename Blend, int W, int H>
+void blit_mask(
+    int* fb, int pitch, const ClipRect& clip, int x, int y, const CompiledMask<W, H>& m, int c)
+{
+    const BlitRect r = blit_rect(clip, x, y, W, H);
+    if (r.empty())
+        return;
+
+    // Starts at the first visible column, so it stays inside fb when x < 0
+    int* row = fb + (y + r.i0) * pitch + x + r.j0;
+    if (r.j0 == 0 && r.j1 == W)
+    {
+        for (int i = r.i0; i < r.i1; i++, row += pitch)
+            blend_fill_masked<Blend>(row, c, m.bits[i], W);
+        return;
+    }
+
+    for (int i = r.i0; i < r.i1; i++, row += pitch)
+        for (int k = 0; k < m.count[i]; k++)
+        {
+            const int a = std::max<int>(m.spans[i][k].x, r.j0);
+            const int b = std::min<int>(m.spans[i][k].x + m.spans[i][k].len, r.j1);
+            for (int j = a - r.j0; j < b - r.j0; j++)
+                row[j] = Blend::apply(row[j], c);
+        }
+}
+
+// Colour-keyed image compiled to the opaque runs of each row, so drawing
+// costs in proportion to the visible pixels and each run is blended as one
+// span.
+struct RleImage
+{
+    struct Run
+    {
+        // First column, length, and offset of the run's pixels in pixels
+        int x, len, ofs;
+    };
+    int w = 0, h = 0;
+    // Runs of row i are runs[first[i] .. first[i + 1])
+    std::vector<Run> runs;
+    std::vector<int> first;
+    std::vector<int> pixels;
+};
+
+RleImage rle_compile(const int* aPixels, int w, int h, int key)
+{
+    RleImage img;
+    img.w = w;
+    img.h = h;
+    img.first.push_back(0);
+    for (int i = 0; i < h; i++)
+    {
+        const int* row = aPixels + i * w;
+        for (int j = 0; j < w;)
+        {
+            if (row[j] == key)
+            {
+                j++;
+                continue;
+            }
+            int end = j;
+            while (end < w && row[end] != key)
+                end++;
+            img.runs.push_back({ j, end - j, (int) img.pixels.size() });
+            img.pixels.insert(img.pixels.end(), row + j, row + end);
+            j = end;
+        }
+        img.first.push_back((int) img.runs.size());
+    }
+    return img;
+}
+
+// img with its top left corner at (x, y), modulated (blend_mul) by a colour
+// and blended with Blend. Runs are cut to the clip rect once each.
+template <typename Blend>
+void blit_rle(
+    int* fb, int pitch, const ClipRect& clip, int x, int y, const RleImage& img, int modulate)
+{
+    const BlitRect r = blit_rect(clip, x, y, img.w, img.h);
+    if (r.empty())
+        return;
+
+    constexpr int CHUNK = 64;
+    int span[CHUNK];
+    // Both pointers start at the first visible column so that neither points outside its
+    // buffer when the image is cut off at the left
+    int* row = fb + (y + r.i0) * pitch + x + r.j0;
+    for (int i = r.i0; i < r.i1; i++, row += pitch)
+        for (int k = img.first[i]; k < img.first[i + 1]; k++)
+        {
+            const RleImage::Run& run = img.runs[k];
+            const int a = std::max(run.x, r.j0);
+            const int b = std::min(run.x + run.len, r.j1);
+            const int* src = img.pixels.data() + run.ofs;
+            for (int j = a; j < b; j += CHUNK)
+            {
+                const int n = std::min(CHUNK, b - j);
+                std::copy(src + (j - run.x), src + (j - run.x) + n, span);
+                blend_fill<BlendMul>(span, modulate, n);
+                blend_span<Blend>(row + (j - r.j0), span, n);
+            }
+        }
+}
+
+// Checks a blitter against a per-pixel reference: pixel(i, j, c) gives the
+// colour of source pixel (i, j), or false where it is transparent, and
+// draw(fb, pitch, clip, x, y) is the blitter under test. The w x h source
+// is drawn at positions across and off every edge of the screen and of a
+// tile, on a small framebuffer of random pixels.
+template <typename Blend, typename Draw, typename Pixel>
+bool blit_matches_reference(int w, int h, Draw draw, Pixel pixel)
+{
+    constexpr int fw = 160, fh = 120;
+    const ClipRect clips[] = { { 0, 0, fw, fh }, tile_rect(4, fw, fh) };
+    // Odd, so successive positions fall on different vector lanes
+    const int step = std::max(3, (w / 8) | 1);
+    std::vector<int> fb(fw * fh), ref;
+    Rng rng(1);
+    for (int& p : fb)
+        p = (int) rng.next_u32();
+
+    for (const ClipRect& clip : clips)
+        for (int y = clip.y0 - h - 1; y <= clip.y1 + 1; y += step)
+            for (int x = clip.x0 - w - 1; x <= clip.x1 + 1; x += step)
+            {
+                ref = fb;
+                draw(fb.data(), fw, clip, x, y);
+                for (int i = std::max(0, clip.y0 - y); i < std::min(h, clip.y1 - y); i++)
+                    for (int j = std::max(0, clip.x0 - x); j < std::min(w, clip.x1 - x); j++)
+                    {
+                        int c;
+                        int& d = ref[(y + i) * fw + x + j];
+                        if (pixel(i, j, c))
+                            d = Blend::apply(d, c);
+                    }
+                if (fb != ref)
+                    return false;
+            }
+    return true;
+}
+
+bool blit_selftest()
+{
+    // A 64x64 colour-keyed image, like the ball, against the keyed
+    // per-pixel blit it replaced
+    bool ok = for_each_supported_tier("blit_rle", [] {
+        constexpr int key = (int) 0xff000000;
+        std::vector<int> image(64 * 64);
+        Rng rng(3);
+        for (int& p : image)
+            p = rng.below(3) == 0 ? key : (int) (rng.next_u32() | 0xff000000);
+        const RleImage img = rle_compile(image.data(), 64, 64, key);
+        const int modulate = (int) rng.next_u32();
+        return blit_matches_reference<BlendAdd>(
+            64,
+            64,
+            [&](int* fb, int pitch, const ClipRect& clip, int x, int y) {
+                blit_rle<BlendAdd>(fb, pitch, clip, x, y, img, modulate);
+            },
+            [&](int i, int j, int& out) {
+                const int p = image[i * 64 + j];
+                out = (int) blend_mul(p, modulate);
+                return p != key;
+            });
+    });
+
+    ok &= for_each_supported_tier("blit_mask", [] {
+        unsigned char mask[16 * 16];
+        Rng rng(2);
+        for (unsigned char& b : mask)
+            b = rng.below(3) != 0;
+        const CompiledMask<16, 16> m(mask);
+        const int c = (int) rng.next_u32();
+        return blit_matches_reference<BlendAvg>(
+            16,
+            16,
+            [&](int* fb, int pitch, const ClipRect& clip, int x, int y) {
+                blit_mask<BlendAvg>(fb, pitch, clip, x, y, m, c);
+            },
+            [&](int i, int j, int& out) {
+                out = c;
+                return mask[i * 16 + j] != 0;
+            });
+    });
+    return ok;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Runtime selection of SIMD kernels.
+// The binary is built for the baseline ISA; kernels for wider ISAs are
+// compiled per function (TARGET_AVX2) and only called when the CPU running
+// us supports them. The tier is detected once at startup and can be forced
+// lower with --isa or the PATHFINDER_ISA environment variable, for A/B tests.
+// Each kernel entry point switches on gCpuTier; the branch never changes
+// after startup, so it costs next to nothing.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#    define CPU_X86 1
+#    include <immintrin.h>
+#endif
+
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+#    define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#    define TARGET_AVX2
+#endif
+
+// Whether this build contains kernels of each tier
+#if defined(CPU_X86) && (defined(__SSE2__) || defined(_M_X64))
+#    define CPU_HAVE_SSE2 1
+#endif
+#if defined(CPU_HAVE_SSE2) && (defined(__GNUC__) || defined(__clang__) || defined(__AVX2__))
+#    define CPU_HAVE_AVX2 1
+#endif
+
+enum CpuTier
+{
+    TIER_SCALAR,
+    TIER_SSE2,
+    TIER_AVX2,
+    TIER_COUNT
+};
+
+const char* cpu_tier_name(CpuTier aTier)
+{
+    static const char* names[TIER_COUNT] = { "scalar", "sse2", "avx2" };
+    return names[aTier];
+}
+
+// Best tier both this build and this CPU support
+CpuTier detect_cpu_tier()
+{
+#if defined(CPU_HAVE_AVX2) && defined(__AVX2__)
+    return TIER_AVX2;
+#elif defined(CPU_HAVE_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return TIER_AVX2;
+#endif
+#if defined(CPU_HAVE_SSE2)
+    return TIER_SSE2;
+#else
+    return TIER_SCALAR;
+#endif
+}
+
+const CpuTier gCpuSupported = detect_cpu_tier();
+CpuTier gCpuTier = gCpuSupported;
+
+// Forces a tier by name; tiers the CPU can't run are refused
+bool set_cpu_tier(const char* aName)
+{
+    for (int t = 0; t < TIER_COUNT; t++)
+    {
+        if (strcmp(aName, cpu_tier_name((CpuTier) t)) == 0)
+        {
+            if (t > gCpuSupported)
+            {
+                std::cout << "isa: " << aName << " is not supported here, using "
+                          << cpu_tier_name(gCpuSupported) << "\n";
+                return false;
+            }
+            gCpuTier = (CpuTier) t;
+            return true;
+        }
+    }
+    std::cout << "isa: unknown tier " << aName << "\n";
+    return false;
+}
+
+// Self-tests: element count for comparing kernels with their scalar
+// reference, not a multiple of any vector width so the tails are covered too
+constexpr int SELFTEST_COUNT = 1003;
+
+// Runs aCheck once on every tier this CPU supports, with gCpuTier set to
+// that tier, then restores the selected one. aCheck compares what the tier
+// computes with a scalar reference and returns false on a mismatch.
+template <typename F>
+bool for_each_supported_tier(const char* aName, F aCheck)
+{
+    const CpuTier selected = gCpuTier;
+    bool ok = true;
+    for (int t = TIER_SCALAR; t <= gCpuSupported; t++)
+    {
+        gCpuTier = (CpuTier) t;
+        if (!aCheck())
+        {
+            std::cout << aName << ": wrong result on the " << cpu_tier_name(gCpuTier) << " tier\n";
+            ok = false;
+        }
+    }
+    gCpuTier = selected;
+    return ok;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "stamps.hpp"
+#include "threadpool.hpp"
+#include "tiles.hpp"
+
+// Deferred renderer for G.framebuffer.
+// Draw calls are recorded into a command list; execute() bins the commands
+// into screen tiles and runs the tiles on a WorkerPool. Every pixel belongs to
+// exactly one tile and each tile replays its commands in recording order, so
+// the picture is the same as drawing immediately, without any locking.
+// Binning also gives each worker one tile's framebuffer rows at a time, which
+// stay in L1/L2 however scattered the commands were recorded, so callers
+// record in whatever order is cheapest for them.
+// Included from main.cpp after the rasterizers it replays.
+
+enum DrawOp : uint8_t
+{
+    DRAW_FILL,
+    DRAW_CIRCLE,
+    DRAW_AA_CIRCLE,
+    DRAW_SPRITE,
+    DRAW_BALL,
+};
+
+enum BlendMode : uint8_t
+{
+    BLEND_REPLACE,
+    BLEND_ADD,
+    BLEND_MUL,
+    BLEND_AVG,
+};
+
+struct DrawCommand
+{
+    // Fill, sprite and ball: top left corner; circles: centre
+    int16_t x, y;
+    // Fill: size; circles: radius in w
+    uint16_t w, h;
+    int color;
+    DrawOp op;
+    BlendMode blend;
+};
+
+class DrawList
+{
+public:
+    void clear()
+    {
+        commands.clear();
+        ranges.clear();
+    }
+
+    int size() const { return (int) commands.size(); }
+
+    // Cut to the screen here, so any size fits the 16-bit fields
+    void fill(int x, int y, int w, int h, int c, BlendMode b = BLEND_REPLACE)
+    {
+        const int x0 = std::max(x, 0), x1 = std::min(x + w, WINDOW_WIDTH);
+        const int y0 = std::max(y, 0), y1 = std::min(y + h, WINDOW_HEIGHT);
+        if (x1 <= x0 || y1 <= y0)
+            return;
+        record({ 0, 0, (uint16_t) (x1 - x0), (uint16_t) (y1 - y0), c, DRAW_FILL, b },
+               x0,
+               y0,
+               { x0, y0, x1, y1 });
+    }
+
+    void circle(int x, int y, int r, int c, BlendMode b = BLEND_REPLACE)
+    {
+        // Looked up here, as the stamp cache must not grow while tiles run
+        if ((int) stamps.size() <= r)
+            stamps.resize(r + 1);
+        if (!stamps[r])
+            stamps[r] = &get_stamp(r);
+        const Stamp& s = *stamps[r];
+        record({ 0, 0, (uint16_t) r, 0, c, DRAW_CIRCLE, b },
+               x,
+               y,
+               { x + s.left, y - r, x + s.right, y + r });
+    }
+
+    // Anti-aliased, see AaStamp
+    void aa_circle(int x, int y, int r, int c, BlendMode b = BLEND_REPLACE)
+    {
+        if ((int) aa_stamps.size() <= r)
+            aa_stamps.resize(r + 1);
+        if (!aa_stamps[r])
+            aa_stamps[r] = &get_aa_stamp(r);
+        const AaStamp& s = *aa_stamps[r];
+        record({ 0, 0, (uint16_t) r, 0, c, DRAW_AA_CIRCLE, b },
+               x,
+               y,
+               { x + s.left, y - r, x + s.right, y + r });
+    }
+
+    void sprite(int x, int y, int c, BlendMode b = BLEND_REPLACE)
+    {
+        record({ 0, 0, 16, 16, c, DRAW_SPRITE, b }, x, y, { x, y, x + 16, y + 16 });
+    }
+
+    void ball(int x, int y, int c, BlendMode b = BLEND_REPLACE)
+    {
+        record({ 0, 0, 64, 64, c, DRAW_BALL, b }, x, y, { x, y, x + 64, y + 64 });
+    }
+
+    // Draw everything recorded so far into G.framebuffer, then clear.
+    // A single thread replays the list as recorded; binning only pays off
+    // when the tiles are shared out.
+    void execute(WorkerPool& aWorkers)
+    {
+        if (aWorkers.size() == 1)
+        {
+            const ClipRect screen = { 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT };
+            for (const DrawCommand& cmd : commands)
+                replay(cmd, screen);
+            clear();
+            return;
+        }
+
+        bin();
+        aWorkers.run(TILES, [this](int t) {
+            if (start[t] == start[t + 1])
+                return;
+            const ClipRect clip = tile_rect(t, WINDOW_WIDTH, WINDOW_HEIGHT);
+            for (int k = start[t]; k < start[t + 1]; k++)
+                replay(commands[bins[k]], clip);
+        });
+        clear();
+    }
+
+private:
+    static constexpr int TILES_X = (WINDOW_WIDTH + TILE_SIZE - 1) >> TILE_SHIFT;
+    static constexpr int TILES_Y = (WINDOW_HEIGHT + TILE_SIZE - 1) >> TILE_SHIFT;
+    static constexpr int TILES = TILES_X * TILES_Y;
+
+    // Tiles touched by each command
+    struct TileRange
+    {
+        uint8_t tx0, ty0, tx1, ty1;
+    };
+
+    std::vector<DrawCommand> commands;
+    std::vector<TileRange> ranges;
+    // stamps[r] is get_stamp(r) once a radius r circle has been recorded,
+    // aa_stamps[r] likewise get_aa_stamp(r)
+    std::vector<const Stamp*> stamps;
+    std::vector<const AaStamp*> aa_stamps;
+    // Command indices of tile t are bins[start[t] .. start[t + 1]), in
+    // recording order
+    std::vector<int> bins;
+    std::vector<int> start;
+    std::vector<int> next;
+
+    // Commands entirely off screen are dropped here. Circles, sprites and
+    // balls are small, so what is left has its coordinates within a radius
+    // or a sprite size of the screen; fills are clipped by fill(). Either
+    // way they fit in 16 bits. b is the bounding box in pixels.
+    void record(DrawCommand cmd, int x, int y, const ClipRect& b)
+    {
+        if (b.x1 <= 0 || b.y1 <= 0 || b.x0 >= WINDOW_WIDTH || b.y0 >= WINDOW_HEIGHT)
+            return;
+        cmd.x = (int16_t) x;
+        cmd.y = (int16_t) y;
+        commands.push_back(cmd);
+        ranges.push_back({ (uint8_t) (std::max(b.x0, 0) >> TILE_SHIFT),
+                           (uint8_t) (std::max(b.y0, 0) >> TILE_SHIFT),
+                           (uint8_t) ((std::min(b.x1, WINDOW_WIDTH) - 1) >> TILE_SHIFT),
+                           (uint8_t) ((std::min(b.y1, WINDOW_HEIGHT) - 1) >> TILE_SHIFT) });
+    }
+
+    // Counting sort of the commands into their tiles, keeping recording order
+    void bin()
+    {
+        const int n = (int) commands.size();
+        start.assign(TILES + 1, 0);
+        for (const TileRange& r : ranges)
+            for (int ty = r.ty0; ty <= r.ty1; ty++)
+                for (int tx = r.tx0; tx <= r.tx1; tx++)
+                    start[ty * TILES_X + tx + 1]++;
+        for (int t = 0; t < TILES; t++)
+            start[t + 1] += start[t];
+
+        bins.resize(start[TILES]);
+        next.assign(start.begin(), start.end() - 1);
+        for (int i = 0; i < n; i++)
+        {
+            const TileRange& r = ranges[i];
+            for (int ty = r.ty0; ty <= r.ty1; ty++)
+                for (int tx = r.tx0; tx <= r.tx1; tx++)
+                    bins[next[ty * TILES_X + tx]++] = i;
+        }
+    }
+
+    template <typename Blend>
+    void replay(const DrawCommand& cmd, const ClipRect& clip) const
+    {
+        switch (cmd.op)
+        {
+        case DRAW_FILL:
+        {
+            const int x0 = std::max<int>(cmd.x, clip.x0);
+            const int x1 = std::min(cmd.x + cmd.w, clip.x1);
+            const int y0 = std::max<int>(cmd.y, clip.y0);
+            const int y1 = std::min(cmd.y + cmd.h, clip.y1);
+            for (int y = y0; y < y1; y++)
+                blend_fill<Blend>(G.framebuffer + y * WINDOW_WIDTH + x0, cmd.color, x1 - x0);
+            break;
+        }
+        case DRAW_CIRCLE:
+            draw_stamp<Blend>(
+                G.framebuffer, WINDOW_WIDTH, clip, *stamps[cmd.w], cmd.x, cmd.y, cmd.color);
+            break;
+        case DRAW_AA_CIRCLE:
+            draw_aa_stamp<Blend>(
+                G.framebuffer, WINDOW_WIDTH, clip, *aa_stamps[cmd.w], cmd.x, cmd.y, cmd.color);
+            break;
+        case DRAW_SPRITE:
+            drawsprite<Blend>(cmd.x, cmd.y, (unsigned int) cmd.color, clip);
+            break;
+        case DRAW_BALL:
+            drawball<Blend>(cmd.x, cmd.y, cmd.color, clip);
+            break;
+        }
+    }
+
+    void replay(const DrawCommand& cmd, const ClipRect& clip) const
+    {
+        switch (cmd.blend)
+        {
+        case BLEND_REPLACE:
+            replay<BlendReplace>(cmd, clip);
+            break;
+        case BLEND_ADD:
+            replay<BlendAdd>(cmd, clip);
+            break;
+        case BLEND_MUL:
+            replay<BlendMul>(cmd, clip);
+            break;
+        case BLEND_AVG:
+            replay<BlendAvg>(cmd, clip);
+            break;
+        }
+    }
+};
@@ -1,11 +1,24 @@
+#include <algorithm>
 #include <string>
 #include <cmath>
 #include <cstdlib>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../deps/stb_image.h"
 
 #include "stopwatch.hpp"
+#include "blend.hpp"
+#include "blit.hpp"
+#include "particles.hpp"
+#include "particle_kernels.hpp"
+#include "points.hpp"
+#include "threadpool.hpp"
+#include "rng.hpp"
+#include "simclock.hpp"
+#include "stamps.hpp"
+#include "tiles.hpp"
+#include "vertex.hpp"
 
 #ifdef __EMSCRIPTEN__
 #    include <emscripten/emscripten.h>
@@ -47,114 +60,251 @@ struct SdlGlobal
     SDL_Texture* texture { nullptr };
 } G;
 
-// Vertex structure
-struct Vertex
-{
-    float x, y, z;
-};
-
 // Original vertices
 Vertex* gVtx;
-// Transformed vertices
-Vertex* gRVtx;
-
-struct Particle
+// Number of vertices; 0 without a point cloud
+int gVertexCount = 0;
+// gVtx as structure of arrays, and transformed
+VertexBuffer gVtxBuffer;
+VertexBuffer gRVtxBuffer;
+
+// Independent random streams per subsystem, all derived from one seed so a
+// run can be replayed exactly
+constexpr uint64_t RNG_SEED = 0x5eed;
+enum RngStream
 {
-    float x = 0;
-    float y = 0;
-    float xi = 0;
-    float yi = 0;
-    int live = 0;
-    int gen = 0;
-    int type = 0;
-    int color = 0;
+    RNG_PARTICLES,
+    RNG_SNOW,
+    RNG_SCENE,
+    RNG_VERTICES
 };
+Rng gRngParticles(RNG_SEED, RNG_PARTICLES);
+Rng gRngSnow(RNG_SEED, RNG_SNOW);
+Rng gRngScene(RNG_SEED, RNG_SCENE);
 
-#define MAX_PARTICLES 16384
-Particle gParticle[MAX_PARTICLES];
-unsigned int gNextParticle = 0;
+ParticlePool gParticles[PARTICLE_TYPES];
 
 void spawn(Particle q)
 {
-    int n = gNextParticle % MAX_PARTICLES;
-    gNextParticle++;
-    gParticle[n] = q;
+    gParticles[q.type].spawn(q);
+}
+
+void burst(const Emitter& e)
+{
+    emit_burst(gParticles[e.type], e, gRngParticles);
 }
 
 int* gBall;
+RleImage gBallRle;
 int* gFrameBufferPile;
 int gFrame = 0;
 constexpr int WINDOW_WIDTH = 1920 / 2;
 constexpr int WINDOW_HEIGHT = 1080 / 2;
+constexpr ClipRect SCREEN_CLIP = { 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT };
+// Particles are updated in fixed-size chunks, so the work split (and with it
+// the order births are merged in) doesn't depend on the number of threads.
+constexpr int PARTICLE_CHUNK = 4096;
+
+// Births found while updating one chunk. Workers only record the parent
+// particle and what to emit from it; the new particles are created after the
+// parallel part of the tick, chunk by chunk, so the result is the same on
+// every run.
+using EmitFn = void (*)(const Particle& aParent);
+
+struct Birth
+{
+    EmitFn emit;
+    Particle parent;
+};
+
+struct SpawnBuffer
+{
+    std::vector<Birth> births;
+};
+
+// One kind of particle. Every type lives in its own pool and has its own
+// update and draw kernels, so the hot loops never branch on type. A new
+// behaviour is a new ParticleType plus an entry in gBehaviour.
+class DrawList;
+
+struct ParticleBehaviour
+{
+    const char* name;
+    // Advance particles [begin, end) by one tick, recording births in out
+    void (*update)(ParticlePool& p, int begin, int end, SpawnBuffer& out);
+    // Record the whole pool into out, stepped back by a fraction of a tick
+    // (see SimClock)
+    void (*draw)(const ParticlePool& p, float back, DrawList& out);
+};
+
+// A chunk of one pool, updated by one worker
+struct ParticleJob
+{
+    int type;
+    int begin;
+    int end;
+};
+
+WorkerPool* gWorkers;
+
+struct Options
+{
+    // Capacity of each particle pool; 0 picks the default for the scene
+    int particles = 0;
+    // Start pools small and let them grow up to the capacity
+    bool grow = false;
+    // Replace the fireworks with a spark fountain that fills the pools
+    bool stress = false;
+    // Time the circle rasterizer and exit
+    bool bench_circles = false;
+    // Vertices in the rotating point cloud; 0 for none
+    int vertices = 0;
+} gOptions;
+
+// Timings shown in the stopwatch table on exit, and once a second in the
+// stress scene. Created on first use like STOPWATCH, so runs that never get
+// to the main loop print no table.
+stopwatch::Aggregate& tick_time()
+{
+    static stopwatch::Aggregate aggregate("physics_tick");
+    return aggregate;
+}
+
+stopwatch::Aggregate& draw_time()
+{
+    static stopwatch::Aggregate aggregate("particle draw");
+    return aggregate;
+}
+
+std::vector<ParticleJob> gParticleJobs;
+std::vector<SpawnBuffer> gSpawnBuffers;
+
+void emit_trail(const Particle& r)
+{
+    spawn({ r.x,
+            r.y,
+            gRngParticles.below(100) / 200.0f - 0.25f,
+            gRngParticles.below(100) / 200.0f,
+            50 + gRngParticles.below(20),
+            0,
+            PARTICLE_SPARK,
+            0 });
+}
+
+void emit_explosion(const Particle& r)
+{
+    burst({ .type = PARTICLE_SMOKE, .count = 12, .x = r.x, .y = r.y, .live = 10 });
+    burst({ .type = PARTICLE_ROCKET,
+            .count = 12,
+            .x = r.x,
+            .y = r.y,
+            .xi = r.xi / 2,
+            .xi_min = -2,
+            .xi_max = 2,
+            .yi_min = -5.12f,
+            .yi_max = 0,
+            .live = 60,
+            .live_spread = 40,
+            .gen = r.gen + 1 });
+}
+
+void update_rocket(ParticlePool& p, int begin, int end, SpawnBuffer& out)
+{
+    // Trails start from the position before this tick's move
+    for (int i = begin; i < end; i++)
+        out.births.push_back({ emit_trail, { p.x[i], p.y[i] } });
+
+    integrate<true, true>(p, begin, end);
+
+    for (int i = begin; i < end; i++)
+        if (p.live[i] <= 0 && p.y[i] < WINDOW_HEIGHT && p.gen[i] < 2)
+            out.births.push_back(
+                { emit_explosion, { p.x[i], p.y[i], p.xi[i], p.yi[i], 0, p.gen[i] } });
+}
+
+void update_spark(ParticlePool& p, int begin, int end, SpawnBuffer&)
+{
+    integrate<false, true>(p, begin, end);
+}
+
+void update_smoke(ParticlePool& p, int begin, int end, SpawnBuffer&)
+{
+    integrate<false, false>(p, begin, end);
+}
+
+void draw_smoke(const ParticlePool& p, float back, DrawList& out);
+void draw_glow(const ParticlePool& p, float back, DrawList& out);
+
+// In ParticleType order, which is also the drawing order
+const ParticleBehaviour gBehaviour[PARTICLE_TYPES] = {
+    { "smoke", update_smoke, draw_smoke },
+    { "spark", update_spark, draw_glow },
+    { "rocket", update_rocket, draw_glow },
+};
+
+// Keeps the spark pool close to full: sparks live 60 ticks on average
+void stress_tick()
+{
+    burst({ .type = PARTICLE_SPARK,
+            .count = gParticles[PARTICLE_SPARK].max_capacity / 60,
+            .y = WINDOW_HEIGHT,
+            .x_spread = WINDOW_WIDTH,
+            .yi = -2,
+            .xi_min = -2,
+            .xi_max = 2,
+            .yi_min = -4,
+            .yi_max = 0,
+            .live = 50,
+            .live_spread = 20 });
+}
+
 void physics_tick(Uint64 aTicks)
 {
+    stopwatch::Aggregate& aggregate = tick_time();
+    stopwatch::Measurement measurement(aggregate.sum, aggregate.measurements);
 
-    if (((aTicks / 8) % 80) == 0)
+    if (gOptions.stress)
+    {
+        stress_tick();
+    }
+    else if (((aTicks / 8) % 80) == 0)
     {
         spawn({ WINDOW_WIDTH / 2,
                 WINDOW_HEIGHT,
-                (rand() % 256 - 128) / 32.0f,
-                -6 - (rand() % 256) / 64.0f,
-                100 + rand() % 20,
-                0,
+                (gRngParticles.below(256) - 128) / 32.0f,
+                -6 - gRngParticles.below(256) / 64.0f,
+                100 + gRngParticles.below(20),
                 0,
+                PARTICLE_ROCKET,
                 0 });
     }
 
-    for (int i = 0; i < MAX_PARTICLES; i++)
+    gParticleJobs.clear();
+    for (int t = 0; t < PARTICLE_TYPES; t++)
     {
-        if (gParticle[i].live)
-        {
-            if (gParticle[i].type == 0)
-            {
-                spawn({ gParticle[i].x,
-                        gParticle[i].y,
-                        (rand() % 100) / 200.0f - 0.25f,
-                        (rand() % 100) / 200.0f,
-                        50 + rand() % 20,
-                        0,
-                        1,
-                        0 });
-                gParticle[i].yi += 0.1f;
-                gParticle[i].x += gParticle[i].xi;
-                gParticle[i].y += gParticle[i].yi;
-                gParticle[i].live--;
-                if (!gParticle[i].live && gParticle[i].y < WINDOW_HEIGHT && gParticle[i].gen < 2)
-                {
-                    float x = gParticle[i].x;
-                    float y = gParticle[i].y;
-                    float xi = gParticle[i].xi / 2;
-                    float yi = 0;
-                    int gen = gParticle[i].gen + 1;
-
-                    for (int j = 0; j < 12; j++)
-                    {
-                        spawn({ x, y, 0, 0, 10, 0, 2, 0 });
-                        spawn({ x,
-                                y,
-                                xi + (rand() % 256 - 128) / 64.0f,
-                                yi - (float) (rand() % 512) / 100.0f,
-                                60 + rand() % 40,
-                                gen,
-                                0,
-                                0 });
-                    }
-                }
-            }
-
-            if (gParticle[i].type == 1)
-            {
-                gParticle[i].y += gParticle[i].yi;
-                gParticle[i].x += gParticle[i].xi;
-                gParticle[i].live--;
-            }
-
-            if (gParticle[i].type == 2)
-            {
-                gParticle[i].live--;
-            }
-        }
+        int n = gParticles[t].count;
+        for (int begin = 0; begin < n; begin += PARTICLE_CHUNK)
+            gParticleJobs.push_back({ t, begin, std::min(begin + PARTICLE_CHUNK, n) });
     }
+    int jobs = (int) gParticleJobs.size();
+    if ((int) gSpawnBuffers.size() < jobs)
+        gSpawnBuffers.resize(jobs);
+
+    gWorkers->run(jobs, [](int j) {
+        const ParticleJob& job = gParticleJobs[j];
+        SpawnBuffer& out = gSpawnBuffers[j];
+        out.births.clear();
+        gBehaviour[job.type].update(gParticles[job.type], job.begin, job.end, out);
+    });
+
+    // Remove the dead before the births are appended
+    for (auto& p : gParticles)
+        p.remove_dead();
+
+    // Merge in job order
+    for (int j = 0; j < jobs; j++)
+        for (const Birth& b : gSpawnBuffers[j].births)
+            b.emit(b.parent);
 }
 void putpixel(int x, int y, int color)
 {
@@ -165,12 +315,17 @@ void putpixel(int x, int y, int color)
     G.framebuffer[y * WINDOW_WIDTH + x] = color;
 }
 
-constexpr int vertices_n = 512;
-
 void newsnow()
 {
+    static PointPlotter plotter;
+    int xs[8], ys[8] = {}, cs[8];
+    gRngSnow.fill_below(xs, 8, WINDOW_WIDTH - 2);
     for (int i = 0; i < 8; i++)
-        G.framebuffer[rand() % (WINDOW_WIDTH - 2) + 1] = 0xffffffff;
+    {
+        xs[i] += 1;
+        cs[i] = (int) 0xffffffff;
+    }
+    plotter.plot<BlendReplace>(G.framebuffer, WINDOW_WIDTH, SCREEN_CLIP, xs, ys, cs, 8);
 }
 
 void snowfall()
@@ -231,134 +386,59 @@ bool update()
     return true;
 }
 
-unsigned int blend_avg(int source, int target)
+// The ball image, and its opaque runs
+void set_ball(int* aPixels)
 {
-    unsigned int sourcer = ((unsigned int) source >> 0) & 0xff;
-    unsigned int sourceg = ((unsigned int) source >> 8) & 0xff;
-    unsigned int sourceb = ((unsigned int) source >> 16) & 0xff;
-    unsigned int targetr = ((unsigned int) target >> 0) & 0xff;
-    unsigned int targetg = ((unsigned int) target >> 8) & 0xff;
-    unsigned int targetb = ((unsigned int) target >> 16) & 0xff;
-
-    targetr = (sourcer + targetr) / 2;
-    targetg = (sourceg + targetg) / 2;
-    targetb = (sourceb + targetb) / 2;
-
-    return (targetr << 0) | (targetg << 8) | (targetb << 16) | 0xff000000;
+    gBall = aPixels;
+    gBallRle = rle_compile(gBall, 64, 64, (int) 0xff000000);
 }
 
-unsigned int blend_mul(int source, int target)
+// Ball sprite modulated by c, blended with Blend; only pixels inside clip
+// are written
+template <typename Blend = BlendReplace>
+void drawball(int x, int y, int c, const ClipRect& clip = SCREEN_CLIP)
 {
-    unsigned int sourcer = ((unsigned int) source >> 0) & 0xff;
-    unsigned int sourceg = ((unsigned int) source >> 8) & 0xff;
-    unsigned int sourceb = ((unsigned int) source >> 16) & 0xff;
-    unsigned int targetr = ((unsigned int) target >> 0) & 0xff;
-    unsigned int targetg = ((unsigned int) target >> 8) & 0xff;
-    unsigned int targetb = ((unsigned int) target >> 16) & 0xff;
-
-    targetr = (sourcer * targetr) >> 8;
-    targetg = (sourceg * targetg) >> 8;
-    targetb = (sourceb * targetb) >> 8;
-
-    return (targetr << 0) | (targetg << 8) | (targetb << 16) | 0xff000000;
+    blit_rle<Blend>(G.framebuffer, WINDOW_WIDTH, clip, x, y, gBallRle, c);
 }
 
-unsigned int blend_add(int source, int target)
-{
-    unsigned int sourcer = ((unsigned int) source >> 0) & 0xff;
-    unsigned int sourceg = ((unsigned int) source >> 8) & 0xff;
-    unsigned int sourceb = ((unsigned int) source >> 16) & 0xff;
-    unsigned int targetr = ((unsigned int) target >> 0) & 0xff;
-    unsigned int targetg = ((unsigned int) target >> 8) & 0xff;
-    unsigned int targetb = ((unsigned int) target >> 16) & 0xff;
-
-    targetr += sourcer;
-    targetg += sourceg;
-    targetb += sourceb;
-
-    if (targetr > 0xff)
-        targetr = 0xff;
-    if (targetg > 0xff)
-        targetg = 0xff;
-    if (targetb > 0xff)
-        targetb = 0xff;
+#include "sprites.hpp"
+#include "drawlist.hpp"
 
-    return (targetr << 0) | (targetg << 8) | (targetb << 16) | 0xff000000;
-}
+DrawList gDrawList;
 
-void drawball(int x, int y, int c)
+// Circle rasterizer for every blend mode, see Stamp
+template <typename Blend>
+void drawcircle_blend(int x, int y, int r, int c)
 {
-    for (int i = 0; i < 64; i++)
-        for (int j = 0; j < 64; j++)
-            if (gBall[i * 64 + j] != 0xff000000)
-                G.framebuffer[x + j + (y + i) * WINDOW_WIDTH] =
-                    blend_mul(gBall[i * 64 + j], c) | 0xff000000;
+    draw_stamp<Blend>(G.framebuffer, WINDOW_WIDTH, SCREEN_CLIP, get_stamp(r), x, y, c);
 }
 
 void drawcircle(int x, int y, int r, int c)
 {
-    for (int i = 0; i < 2 * r; i++)
-    {
-        // vertical clipping: (top and bottom)
-        if ((y - r + i) >= 0 && (y - r + i) < WINDOW_HEIGHT)
-        {
-            int len = (int) (sqrt(r * r - (r - i) * (r - i)) * 2);
-            int xofs = x - len / 2;
-
-            // left border
-            if (xofs < 0)
-            {
-                len += xofs;
-                xofs = 0;
-            }
-
-            // right border
-            if (xofs + len >= WINDOW_WIDTH)
-            {
-                len -= (xofs + len) - WINDOW_WIDTH;
-            }
-            int ofs = (y - r + i) * WINDOW_WIDTH + xofs;
-
-            // note that len may be 0 at this point,
-            // and no pixels get drawn!
-            for (int j = 0; j < len; j++)
-                G.framebuffer[ofs + j] = c;
-        }
-    }
+    drawcircle_blend<BlendReplace>(x, y, r, c);
 }
 
 void drawcircle_add(int x, int y, int r, int c)
 {
-    for (int i = 0; i < 2 * r; i++)
-    {
-        // vertical clipping: (top and bottom)
-        if ((y - r + i) >= 0 && (y - r + i) < WINDOW_HEIGHT)
-        {
-            int len = (int) (sqrt(r * r - (r - i) * (r - i)) * 2);
-            int xofs = x - len / 2;
-
-            // left border
-            if (xofs < 0)
-            {
-                len += xofs;
-                xofs = 0;
-            }
+    drawcircle_blend<BlendAdd>(x, y, r, c);
+}
 
-            // right border
-            if (xofs + len >= WINDOW_WIDTH)
-            {
-                len -= (xofs + len) - WINDOW_WIDTH;
-            }
-            int ofs = (y - r + i) * WINDOW_WIDTH + xofs;
+void drawcircle_mul(int x, int y, int r, int c)
+{
+    drawcircle_blend<BlendMul>(x, y, r, c);
+}
 
-            // note that len may be 0 at this point,
-            // and no pixels get drawn!
-            for (int j = 0; j < len; j++)
-                G.framebuffer[ofs + j] = blend_add(G.framebuffer[ofs + j], c);
-        }
-    }
+// Anti-aliased circle, see AaStamp
+template <typename Blend>
+void drawcircle_aa(int x, int y, int r, int c)
+{
+    draw_aa_stamp<Blend>(G.framebuffer, WINDOW_WIDTH, SCREEN_CLIP, get_aa_stamp(r), x, y, c);
 }
-void drawcircle_mul(int x, int y, int r, int c)
+
+// drawcircle_add computing each row with sqrt, as before circle_spans;
+// the baseline for bench_circles. Rows are filled with the same kernel as
+// drawcircle_add, so the bench compares only the span computation.
+void drawcircle_add_sqrt(int x, int y, int r, int c)
 {
     for (int i = 0; i < 2 * r; i++)
     {
@@ -384,11 +464,11 @@ void drawcircle_mul(int x, int y, int r, int c)
 
             // note that len may be 0 at this point,
             // and no pixels get drawn!
-            for (int j = 0; j < len; j++)
-                G.framebuffer[ofs + j] = blend_mul(G.framebuffer[ofs + j], c);
+            blend_fill<BlendAdd>(G.framebuffer + ofs, c, len);
         }
     }
 }
+
 void init_gfx()
 {
     for (int i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; i++)
@@ -403,14 +483,15 @@ void init_gfx()
             G.framebuffer[i * WINDOW_WIDTH + j] = c;
         }
     }
+    // stars
+    int ys[100], xs[100], cs[100];
+    gRngScene.fill_below(ys, 100, WINDOW_HEIGHT / 2);
+    gRngScene.fill_below(xs, 100, WINDOW_WIDTH);
+    gRngScene.fill_below(cs, 100, 0xff);
     for (int i = 0; i < 100; i++)
-    {
-        int y = rand() % (WINDOW_HEIGHT / 2);
-        int x = rand() % WINDOW_WIDTH;
-        int c = rand() % 0xff;
-        c = 0x010101 * c | 0xff000000;
-        G.framebuffer[y * WINDOW_WIDTH + x] = blend_add(c, G.framebuffer[y * WINDOW_WIDTH + x]);
-    }
+        cs[i] = 0x010101 * cs[i] | 0xff000000;
+    PointPlotter stars;
+    stars.plot<BlendAdd>(G.framebuffer, WINDOW_WIDTH, SCREEN_CLIP, xs, ys, cs, 100);
     drawcircle(WINDOW_WIDTH / 2, 100, 60, 0xffff7f00);
     // ground
     for (int i = 0; i < WINDOW_WIDTH; i++)
@@ -425,17 +506,17 @@ void init_gfx()
     // trees
     for (int count = 0; count < 60; count++)
     {
-        int xofs = rand() % WINDOW_WIDTH;
+        int xofs = gRngScene.below(WINDOW_WIDTH);
         int yofs = WINDOW_HEIGHT / 2 - 60 + count;
-        int ht = rand() % WINDOW_HEIGHT / 10 + WINDOW_HEIGHT / 5;
+        int ht = gRngScene.below(WINDOW_HEIGHT) / 10 + WINDOW_HEIGHT / 5;
 
-        int c = rand() % 0x1f;
+        int c = gRngScene.below(0x1f);
         c = 0x000100 * c | 0xff000000;
 
         for (int i = 0; i < ht; i++)
         {
             int w = (ht / 3) * (ht - i) / ht;
-            int nudge = (w > 3 ? rand() % 7 - 3 : 0);
+            int nudge = (w > 3 ? gRngScene.below(7) - 3 : 0);
             for (int j = 0; j < w; j++)
             {
                 int p = j - w / 2 + xofs + nudge;
@@ -449,15 +530,21 @@ void scaleblit()
 {
     constexpr double zoom = 0.99;
     constexpr double expand = (1.0 - zoom) * 0.5;
+    // Source column of each destination column is the same on every row
+    static int xsrc[WINDOW_WIDTH];
+    for (int j = 0; j < WINDOW_WIDTH; j++)
+        xsrc[j] = (int) ((j * zoom) + (WINDOW_WIDTH * expand));
+
+    // Gather the zoomed source row, then average it in as one span
+    int row[WINDOW_WIDTH];
     int yofs = 0;
     for (int i = 0; i < WINDOW_HEIGHT; i++)
     {
+        const unsigned int* src =
+            G.tmp_buffer + (int) ((i * zoom) + (WINDOW_HEIGHT * expand)) * WINDOW_WIDTH;
         for (int j = 0; j < WINDOW_WIDTH; j++)
-        {
-            int c = (int) ((i * zoom) + (WINDOW_HEIGHT * expand)) * WINDOW_WIDTH
-                    + (int) ((j * zoom) + (WINDOW_WIDTH * expand));
-            G.framebuffer[yofs + j] = blend_avg(G.framebuffer[yofs + j], G.tmp_buffer[c]);
-        }
+            row[j] = (int) src[xsrc[j]];
+        blend_avg_span(G.framebuffer + yofs, row, WINDOW_WIDTH);
         yofs += WINDOW_WIDTH;
     }
 }
@@ -503,46 +590,9 @@ void dist(float v)
     }
 }
 
-void rotate_z(double angle)
-{
-    float ca = (float) cos(angle);
-    float sa = (float) sin(angle);
-    for (int i = 0; i < vertices_n; i++)
-    {
-        float x = gRVtx[i].x * ca - gRVtx[i].y * sa;
-        float y = gRVtx[i].x * sa + gRVtx[i].y * ca;
-        gRVtx[i].x = x;
-        gRVtx[i].y = y;
-    }
-}
-void rotate_y(double angle)
+// a is the hue angle, color / 1024
+int gen_color_phase(float a, int live, float scale)
 {
-    float ca = (float) cos(angle);
-    float sa = (float) sin(angle);
-    for (int i = 0; i < vertices_n; i++)
-    {
-        float z = gRVtx[i].z * ca - gRVtx[i].x * sa;
-        float x = gRVtx[i].z * sa + gRVtx[i].x * ca;
-        gRVtx[i].z = z;
-        gRVtx[i].x = x;
-    }
-}
-void rotate_x(double angle)
-{
-    float ca = (float) cos(angle);
-    float sa = (float) sin(angle);
-    for (int i = 0; i < vertices_n; i++)
-    {
-        float y = gRVtx[i].y * ca - gRVtx[i].z * sa;
-        float z = gRVtx[i].y * sa + gRVtx[i].z * ca;
-        gRVtx[i].y = y;
-        gRVtx[i].z = z;
-    }
-}
-
-int gen_color(int color, int live, float scale)
-{
-    float a = color / 1024.0f;
     int r = sin(a) * 127 + 128;
     int g = sin(a + 2 * M_PI / 3) * 127 + 128;
     int b = sin(a + 4 * M_PI / 3) * 127 + 128;
@@ -556,54 +606,219 @@ int gen_color(int color, int live, float scale)
     return (b << 16) | (g << 8) | (r << 0) | 0xff000000;
 }
 
-void render(Uint64 aTicks)
+int gen_color(int color, int live, float scale)
+{
+    return gen_color_phase(color / 1024.0f, live, scale);
+}
+
+// gen_color lookup table for the particle renderer, indexed by hue phase and
+// lifetime. The hue repeats every 2 * pi * 1024 colour units; that period is
+// split into PALETTE_PHASES steps. Lifetimes are clamped to the table.
+constexpr int PALETTE_PHASES = 64;
+constexpr int PALETTE_LIVE = 128;
+
+struct Palette
 {
-    static Uint64 lastTick = 0;
+    // scale 0.1, the wide glow pass
+    int glow[PALETTE_PHASES][PALETTE_LIVE];
+    // scale 1, the bright core
+    int core[PALETTE_PHASES][PALETTE_LIVE];
+} gPalette;
 
-    for (int i = 0; i < WINDOW_HEIGHT; i++)
+void init_palette()
+{
+    for (int i = 0; i < PALETTE_PHASES; i++)
     {
-        int c = (64 * i) / WINDOW_HEIGHT;
-        c = 0x010000 * c | 0xff000000;
-        for (int j = 0; j < WINDOW_WIDTH; j++)
+        float a = (float) (i * 2 * M_PI / PALETTE_PHASES);
+        for (int j = 0; j < PALETTE_LIVE; j++)
         {
-            G.framebuffer[i * WINDOW_WIDTH + j] = c;
+            gPalette.glow[i][j] = gen_color_phase(a, j, 0.1);
+            gPalette.core[i][j] = gen_color_phase(a, j, 1);
         }
     }
+}
+
+int palette_phase(int color)
+{
+    constexpr float steps_per_unit = (float) (PALETTE_PHASES / (2 * M_PI * 1024));
+    return (int) (color * steps_per_unit) & (PALETTE_PHASES - 1);
+}
+
+int palette_live(int live)
+{
+    return std::clamp(live, 0, PALETTE_LIVE - 1);
+}
+
+// One anti-aliased puff; this used to be a radius 15 multiply under a
+// radius 12 replace to soften the edge
+void draw_smoke(const ParticlePool& p, float, DrawList& out)
+{
+    for (int i = 0; i < p.count; i++)
+    {
+        int x = (int) p.x[i];
+        int y = (int) p.y[i];
+        int c = p.live[i] * 4;
+        c *= 0x010101;
+        c |= 0xff000000;
+        out.aa_circle(x, y, 13, c, BLEND_REPLACE);
+    }
+}
+
+// One tick back is position - velocity
+void draw_glow(const ParticlePool& p, float back, DrawList& out)
+{
+    for (int i = 0; i < p.count; i++)
+    {
+        int x = (int) (p.x[i] - p.xi[i] * back);
+        int y = (int) (p.y[i] - p.yi[i] * back);
+        int phase = palette_phase(p.color[i]);
+        int live = palette_live(p.live[i]);
+        out.circle(x, y, 3, gPalette.glow[phase][live], BLEND_ADD);
+        out.circle(x, y, 1, gPalette.core[phase][live], BLEND_ADD);
+    }
+}
+
+// Point cloud: a torus of gVertexCount vertices, rotated every frame,
+// projected and splatted additively; nearer vertices are larger and brighter
+Camera gCamera = { 400, WINDOW_HEIGHT * 0.9f, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 1 };
+
+void init_vertices(int n)
+{
+    constexpr float ring = 150, tube = 50;
+    gVertexCount = n;
+    gVtx = new Vertex[n];
+    Rng rng(RNG_SEED, RNG_VERTICES);
+    for (int i = 0; i < n; i++)
+    {
+        float u = (float) (rng.uniform() * 2 * M_PI);
+        float v = (float) (rng.uniform() * 2 * M_PI);
+        float w = ring + tube * cosf(v);
+        gVtx[i] = { w * cosf(u), tube * sinf(v), w * sinf(u) };
+    }
+    gVtxBuffer.load(gVtx, n);
+}
+
+void draw_pointcloud(Uint64 aTicks)
+{
+    static std::vector<int> xs, ys, cs;
+    static std::vector<float> depth;
+    static PointPlotter plotter;
+    static DrawList splats;
+    const double t = aTicks / 1000.0;
+    const int n = gVertexCount;
+
+    {
+        STOPWATCH("vtx transform");
+        // z first, then y, then x
+        Mat3 rot = Mat3::rotate_x(t * 0.2) * Mat3::rotate_y(t * 0.3) * Mat3::rotate_z(t * 0.5);
+        transform_vertices(rot, gVtxBuffer, gRVtxBuffer);
+    }
 
-    while (lastTick < aTicks)
+    int visible;
     {
-        physics_tick(lastTick);
-        lastTick += 20;
+        STOPWATCH("vtx project");
+        xs.resize(n);
+        ys.resize(n);
+        cs.resize(n);
+        depth.resize(n);
+        visible = project_vertices(
+            gRVtxBuffer, gCamera, SCREEN_CLIP, xs.data(), ys.data(), depth.data());
     }
 
-    for (int i = 0; i < MAX_PARTICLES; i++)
     {
-        if (gParticle[i].live != 0)
+        STOPWATCH("vtx splat");
+        // Single pixels are gathered at the front of xs / ys for the point
+        // plotter, the few near enough to be bigger become circles
+        int points = 0;
+        for (int i = 0; i < visible; i++)
         {
-            if (gParticle[i].type == 2)
+            float near = gCamera.distance / depth[i];
+            int b = std::min((int) (40 * near * near), 0xff);
+            int c = 0x010101 * b | 0xff000000;
+            int r = (int) (near - 0.5f);
+            if (r == 0)
             {
-                int x = (int) gParticle[i].x;
-                int y = (int) gParticle[i].y;
-                int c = gParticle[i].live * 4;
-                c *= 0x010101;
-                c |= 0xff000000;
-                drawcircle_mul(x, y, 15, c);
-                drawcircle(x, y, 12, c);
+                xs[points] = xs[i];
+                ys[points] = ys[i];
+                cs[points++] = c;
             }
             else
-            {
-                int x = (int) gParticle[i].x;
-                int y = (int) gParticle[i].y;
-
-                int c = gen_color(gParticle[i].color, gParticle[i].live, 0.1);
-                drawcircle_add(x, y, 3, c);
-                c = gen_color(gParticle[i].color, gParticle[i].live, 1);
-                drawcircle_add(x, y, 1, c);
-            }
+                splats.circle(xs[i], ys[i], r, c, BLEND_ADD);
         }
+        plotter.plot<BlendAdd>(
+            G.framebuffer, WINDOW_WIDTH, SCREEN_CLIP, xs.data(), ys.data(), cs.data(), points);
+        splats.execute(*gWorkers);
     }
 }
 
+SimClock gClock;
+
+// Average tick and draw cost over the last second of the stress scene
+void stress_report(Uint64 aTicks)
+{
+    using ms = std::chrono::duration<double, std::milli>;
+    static Uint64 last = aTicks;
+    static stopwatch::Measurement::Clock::duration tick_sum {}, draw_sum {};
+    static int ticks = 0, draws = 0;
+    if (aTicks - last < 1000)
+        return;
+
+    int live = 0;
+    for (const auto& p : gParticles)
+        live += p.count;
+    const stopwatch::Aggregate& tick = tick_time();
+    const stopwatch::Aggregate& draw = draw_time();
+    // Ticks run, capped by the clock, and how many the tick cost would allow
+    int ran = (int) ((tick.measurements - ticks) * 1000 / (aTicks - last));
+    double tick_ms = ms(tick.sum - tick_sum).count() / std::max(tick.measurements - ticks, 1);
+    double draw_ms = ms(draw.sum - draw_sum).count() / std::max(draw.measurements - draws, 1);
+    std::cout << "stress: " << live << " particles, " << ran << " ticks/s, " << tick_ms
+              << " ms/tick (max " << (int) (1000 / std::max(tick_ms, 0.001)) << " ticks/s), draw "
+              << draw_ms << " ms, dropped " << gClock.dilated << " ms\n";
+
+    last = aTicks;
+    tick_sum = tick.sum;
+    draw_sum = draw.sum;
+    ticks = tick.measurements;
+    draws = draw.measurements;
+}
+
+void render(Uint64 aTicks)
+{
+    // Background gradient, one fill per band of equal colour
+    for (int i = 0, c = 0; c < 64; c++)
+    {
+        int end = i;
+        while (end < WINDOW_HEIGHT && (64 * end) / WINDOW_HEIGHT == c)
+            end++;
+        gDrawList.fill(0, i, WINDOW_WIDTH, end - i, 0x010000 * c | 0xff000000);
+        i = end;
+    }
+
+    int steps = gClock.advance(aTicks);
+    for (int i = 0; i < steps; i++)
+    {
+        physics_tick(gClock.time);
+        gClock.time += gClock.step;
+    }
+
+    // Draw between the previous and the current tick
+    {
+        stopwatch::Aggregate& aggregate = draw_time();
+        stopwatch::Measurement measurement(aggregate.sum, aggregate.measurements);
+        const float back = 1.0f - gClock.alpha;
+        for (int t = 0; t < PARTICLE_TYPES; t++)
+            gBehaviour[t].draw(gParticles[t], back, gDrawList);
+        gDrawList.execute(*gWorkers);
+    }
+
+    if (gVertexCount)
+        draw_pointcloud(aTicks);
+
+    if (gOptions.stress)
+        stress_report(aTicks);
+}
+
 void loop()
 {
     if (!update())
@@ -642,6 +857,8 @@ bool init_sdl()
 void destroy()
 {
     // delete gFrameBufferPile;
+    for (int t = 0; t < PARTICLE_TYPES; t++)
+        gParticles[t].report(gBehaviour[t].name);
 
     SDL_DestroyTexture(G.texture);
     SDL_DestroyRenderer(G.renderer);
@@ -649,12 +866,134 @@ void destroy()
     SDL_Quit();
 }
 
+// The particle radii, drawn at the same random spots by both paths
+void bench_circles()
+{
+    constexpr int radii[] = { 1, 3, 12, 15 };
+    constexpr int n = 100000;
+    for (int r : radii)
+    {
+        std::string label = "r=" + std::to_string(r);
+        stopwatch::Aggregate sqrt_time(label + " sqrt");
+        stopwatch::Aggregate table_time(label + " table");
+        stopwatch::Aggregate aa_time(label + " aa");
+        for (int pass = 0; pass < 3; pass++)
+        {
+            Rng rng(r);
+            for (int i = 0; i < n; i++)
+            {
+                int x = rng.below(WINDOW_WIDTH);
+                int y = rng.below(WINDOW_HEIGHT);
+                int c = (int) (rng.next_u32() & 0x030303);
+                if (pass == 0)
+                {
+                    stopwatch::Measurement m(sqrt_time.sum, sqrt_time.measurements);
+                    drawcircle_add_sqrt(x, y, r, c);
+                }
+                else if (pass == 1)
+                {
+                    stopwatch::Measurement m(table_time.sum, table_time.measurements);
+                    drawcircle_add(x, y, r, c);
+                }
+                else
+                {
+                    stopwatch::Measurement m(aa_time.sum, aa_time.measurements);
+                    drawcircle_aa<BlendAdd>(x, y, r, c);
+                }
+            }
+        }
+    }
+}
+
+bool parse_options(int argc, char** argv)
+{
+    if (const char* isa = getenv("PATHFINDER_ISA"))
+        set_cpu_tier(isa);
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--particles" && i + 1 < argc)
+            gOptions.particles = std::max(atoi(argv[++i]), 1);
+        else if (arg == "--grow")
+            gOptions.grow = true;
+        else if (arg == "--stress")
+            gOptions.stress = true;
+        else if (arg == "--bench-circles")
+            gOptions.bench_circles = true;
+        else if (arg == "--isa" && i + 1 < argc)
+            set_cpu_tier(argv[++i]);
+        else if (arg == "--vertices" && i + 1 < argc)
+            gOptions.vertices = std::max(atoi(argv[++i]), 0);
+        else
+        {
+            std::cout << "usage: " << argv[0]
+                      << " [--particles N] [--grow] [--stress] [--bench-circles]"
+                      << " [--isa scalar|sse2|avx2] [--vertices N]\n"
+                      << "  --particles N  capacity of each particle pool (default "
+                      << MAX_PARTICLES << ", 1000000 with --stress)\n"
+                      << "  --grow         allocate pools on demand, up to the capacity\n"
+                      << "  --stress       spark fountain that keeps the pools full, with\n"
+                      << "                 timings printed once a second\n"
+                      << "  --bench-circles  compare circle span tables against sqrt per row\n"
+                      << "  --isa TIER     force the SIMD kernels to a lower tier; also read\n"
+                      << "                 from PATHFINDER_ISA\n"
+                      << "  --vertices N   draw a rotating point cloud of N vertices\n";
+            return false;
+        }
+    }
+
+    if (gOptions.stress)
+        gOptions.grow = true;
+    if (!gOptions.particles)
+        gOptions.particles = gOptions.stress ? 1000000 : MAX_PARTICLES;
+    return true;
+}
+
 int main(int argc, char** argv)
 {
+    if (!parse_options(argc, argv))
+        return -1;
+
+    std::cout << "isa: " << cpu_tier_name(gCpuTier) << "\n";
+
     if (!init_sdl())
         return -1;
 
+    for (auto& p : gParticles)
+        p.init(gOptions.particles, gOptions.grow);
+
     init_gfx();
+    init_palette();
+    if (gOptions.vertices)
+        init_vertices(gOptions.vertices);
+
+    if (gOptions.bench_circles)
+    {
+        bench_circles();
+        destroy();
+        return 0;
+    }
+
+#ifdef __EMSCRIPTEN__
+    gWorkers = new WorkerPool(0);
+#else
+    gWorkers = new WorkerPool((int) std::max(std::thread::hardware_concurrency(), 1u) - 1);
+#endif
+
+#ifdef DEBUG
+    // Every SIMD kernel against its scalar reference, on every tier
+    bool selftest = integrate_selftest();
+    selftest &= blend_selftest();
+    selftest &= blit_selftest();
+    selftest &= clip_points_selftest();
+    selftest &= vertex_selftest();
+    if (!selftest)
+    {
+        std::cout << std::flush;
+        abort();
+    }
+#endif
 
 #ifdef __EMSCRIPTEN__
     emscripten_set_main_loop(loop, 0, 1);
@@ -663,6 +1002,7 @@ int main(int argc, char** argv)
         loop();
 #endif
 
+    delete gWorkers;
     destroy();
     return 0;
 }
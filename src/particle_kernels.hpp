@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "cpu.hpp"
+#include "particles.hpp"
+#include "rng.hpp"
+
+// Particle integrator kernels.
+// Each particle type gets its own instantiation, so there is no per-particle
+// branching: Gravity adds to yi, Moving adds the velocity to the position,
+// and every particle ages by one tick. Lifetimes are decremented under a
+// live > 0 mask (live -= live > 0), so a finished particle stays at zero.
+// integrate_scalar is the reference; the vector versions match it bit for
+// bit.
+
+constexpr float PARTICLE_GRAVITY = 0.1f;
+
+template <bool Gravity, bool Moving>
+void integrate_scalar(ParticlePool& p, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        if constexpr (Gravity)
+            p.yi[i] += PARTICLE_GRAVITY;
+        if constexpr (Moving)
+        {
+            p.x[i] += p.xi[i];
+            p.y[i] += p.yi[i];
+        }
+        if (p.live[i] > 0)
+            p.live[i]--;
+    }
+}
+
+#if defined(CPU_HAVE_SSE2)
+template <bool Gravity, bool Moving>
+void integrate_sse2(ParticlePool& p, int begin, int end)
+{
+    const __m128 gravity = _mm_set1_ps(PARTICLE_GRAVITY);
+    const __m128i zero = _mm_setzero_si128();
+    int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        if constexpr (Moving)
+        {
+            __m128 yi = _mm_loadu_ps(p.yi + i);
+            if constexpr (Gravity)
+            {
+                yi = _mm_add_ps(yi, gravity);
+                _mm_storeu_ps(p.yi + i, yi);
+            }
+            _mm_storeu_ps(p.x + i, _mm_add_ps(_mm_loadu_ps(p.x + i), _mm_loadu_ps(p.xi + i)));
+            _mm_storeu_ps(p.y + i, _mm_add_ps(_mm_loadu_ps(p.y + i), yi));
+        }
+        else if constexpr (Gravity)
+        {
+            _mm_storeu_ps(p.yi + i, _mm_add_ps(_mm_loadu_ps(p.yi + i), gravity));
+        }
+
+        // alive lanes are all ones (-1), so adding the mask decrements them
+        __m128i live = _mm_loadu_si128((const __m128i*) (p.live + i));
+        live = _mm_add_epi32(live, _mm_cmpgt_epi32(live, zero));
+        _mm_storeu_si128((__m128i*) (p.live + i), live);
+    }
+    integrate_scalar<Gravity, Moving>(p, i, end);
+}
+#endif
+
+#if defined(CPU_HAVE_AVX2)
+template <bool Gravity, bool Moving>
+TARGET_AVX2 void integrate_avx2(ParticlePool& p, int begin, int end)
+{
+    const __m256 gravity = _mm256_set1_ps(PARTICLE_GRAVITY);
+    const __m256i zero = _mm256_setzero_si256();
+    int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        if constexpr (Moving)
+        {
+            __m256 yi = _mm256_loadu_ps(p.yi + i);
+            if constexpr (Gravity)
+            {
+                yi = _mm256_add_ps(yi, gravity);
+                _mm256_storeu_ps(p.yi + i, yi);
+            }
+            _mm256_storeu_ps(p.x + i,
+                             _mm256_add_ps(_mm256_loadu_ps(p.x + i), _mm256_loadu_ps(p.xi + i)));
+            _mm256_storeu_ps(p.y + i, _mm256_add_ps(_mm256_loadu_ps(p.y + i), yi));
+        }
+        else if constexpr (Gravity)
+        {
+            _mm256_storeu_ps(p.yi + i, _mm256_add_ps(_mm256_loadu_ps(p.yi + i), gravity));
+        }
+
+        __m256i live = _mm256_loadu_si256((const __m256i*) (p.live + i));
+        live = _mm256_add_epi32(live, _mm256_cmpgt_epi32(live, zero));
+        _mm256_storeu_si256((__m256i*) (p.live + i), live);
+    }
+    // the 4-wide kernel takes what is left, the scalar one the rest
+    integrate_sse2<Gravity, Moving>(p, i, end);
+}
+#endif
+
+// Kernel for the tier picked at startup (see cpu.hpp)
+template <bool Gravity, bool Moving>
+void integrate(ParticlePool& p, int begin, int end)
+{
+    switch (gCpuTier)
+    {
+#if defined(CPU_HAVE_AVX2)
+    case TIER_AVX2:
+        return integrate_avx2<Gravity, Moving>(p, begin, end);
+#endif
+#if defined(CPU_HAVE_SSE2)
+    case TIER_SSE2:
+        return integrate_sse2<Gravity, Moving>(p, begin, end);
+#endif
+    default:
+        return integrate_scalar<Gravity, Moving>(p, begin, end);
+    }
+}
+
+// Runs the selected tier's kernel and the scalar reference over the same
+// random particles and compares the results bit for bit.
+template <bool Gravity, bool Moving>
+bool integrate_matches_scalar()
+{
+    constexpr int n = SELFTEST_COUNT;
+    ParticlePool a, b;
+    a.init(n, false);
+    b.init(n, false);
+    Rng rng(1);
+    for (int i = 0; i < n; i++)
+    {
+        Particle q = { rng.below(2000) / 3.0f,
+                       rng.below(2000) / 3.0f,
+                       (rng.below(256) - 128) / 32.0f,
+                       (rng.below(256) - 128) / 32.0f,
+                       rng.below(3) };
+        a.spawn(q);
+        b.spawn(q);
+    }
+
+    for (int step = 0; step < 4; step++)
+    {
+        integrate<Gravity, Moving>(a, 0, n);
+        integrate_scalar<Gravity, Moving>(b, 0, n);
+    }
+
+    return memcmp(a.x, b.x, sizeof(float) * n) == 0 && memcmp(a.y, b.y, sizeof(float) * n) == 0
+           && memcmp(a.yi, b.yi, sizeof(float) * n) == 0
+           && memcmp(a.live, b.live, sizeof(int) * n) == 0;
+}
+
+bool integrate_selftest()
+{
+    bool ok = for_each_supported_tier("integrate<1, 1>", integrate_matches_scalar<true, true>);
+    ok &= for_each_supported_tier("integrate<0, 1>", integrate_matches_scalar<false, true>);
+    ok &= for_each_supported_tier("integrate<0, 0>", integrate_matches_scalar<false, false>);
+    return ok;
+}
+
+// A burst of particles from one emitter, e.g. an explosion.
+// Position is (x, y) plus a jitter in [0, spread) per axis; velocity is
+// (xi, yi) plus a jitter in [min, max); lifetime is live + [0, live_spread).
+struct Emitter
+{
+    int type = 0;
+    int count = 0;
+    float x = 0;
+    float y = 0;
+    float x_spread = 0;
+    float y_spread = 0;
+    float xi = 0;
+    float yi = 0;
+    float xi_min = 0;
+    float xi_max = 0;
+    float yi_min = 0;
+    float yi_max = 0;
+    int live = 0;
+    int live_spread = 0;
+    int gen = 0;
+    int color = 0;
+};
+
+// offset + u * range over an array of uniform [0, 1) values, in place.
+// Plain contiguous loop, left to the compiler to vectorize.
+void scale_uniform(float* v, int n, float offset, float range)
+{
+    for (int i = 0; i < n; i++)
+        v[i] = offset + v[i] * range;
+}
+
+// Claims e.count contiguous slots at the end of p in one go and fills them
+// array by array; the random parts are generated in batches straight into
+// the pool. Returns the number of particles that fit.
+int emit_burst(ParticlePool& p, const Emitter& e, Rng& rng)
+{
+    const int begin = p.count;
+    const int n = p.append(e.count);
+
+    auto jitter = [&](float* v, float base, float lo, float hi) {
+        if (hi > lo)
+        {
+            rng.fill_uniform(v + begin, n);
+            scale_uniform(v + begin, n, base + lo, hi - lo);
+        }
+        else
+        {
+            std::fill_n(v + begin, n, base);
+        }
+    };
+    jitter(p.x, e.x, 0, e.x_spread);
+    jitter(p.y, e.y, 0, e.y_spread);
+    jitter(p.xi, e.xi, e.xi_min, e.xi_max);
+    jitter(p.yi, e.yi, e.yi_min, e.yi_max);
+
+    if (e.live_spread > 0)
+    {
+        rng.fill_below(p.live + begin, n, e.live_spread);
+        for (int i = begin; i < begin + n; i++)
+            p.live[i] += e.live;
+    }
+    else
+    {
+        std::fill_n(p.live + begin, n, e.live);
+    }
+    std::fill_n(p.gen + begin, n, e.gen);
+    std::fill_n(p.color + begin, n, e.color);
+    return n;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+
+#include "aligned.hpp"
+
+// Particle description, used when spawning. The pool itself keeps every
+// field in its own array.
+struct Particle
+{
+    float x = 0;
+    float y = 0;
+    float xi = 0;
+    float yi = 0;
+    int live = 0;
+    int gen = 0;
+    int type = 0;
+    int color = 0;
+};
+
+// Each type is stored in its own pool; see ParticleBehaviour
+enum ParticleType
+{
+    PARTICLE_SMOKE,
+    PARTICLE_SPARK,
+    PARTICLE_ROCKET,
+    PARTICLE_TYPES
+};
+
+// Default pool capacity; see ParticlePool::init
+#define MAX_PARTICLES 16384
+// First allocation of a growable pool
+#define PARTICLE_POOL_INITIAL 1024
+
+// Structure-of-arrays particle store.
+// Live particles are kept dense in [0, count): spawning appends, and a dead
+// particle is swap-removed with the last one, so every loop over the pool
+// costs what is alive rather than the capacity.
+// A pool holds a single particle type, so type isn't stored.
+// Hot fields (position, velocity, lifetime) are read every tick by the
+// integrator and the draw loop; gen and color are only needed on spawn and
+// when picking a colour, so they live apart and stay out of the cache.
+// Every array is 64-byte aligned.
+struct ParticlePool
+{
+    // Hot
+    float* x = nullptr;
+    float* y = nullptr;
+    float* xi = nullptr;
+    float* yi = nullptr;
+    int* live = nullptr;
+    // Cold
+    int* gen = nullptr;
+    int* color = nullptr;
+
+    int count = 0;
+    int capacity = 0;
+    // A growable pool doubles when full, up to this
+    int max_capacity = 0;
+    // High water mark and number of spawns refused because the pool was full
+    int peak = 0;
+    unsigned int dropped = 0;
+
+    ParticlePool() = default;
+    ParticlePool(const ParticlePool&) = delete;
+    ParticlePool& operator=(const ParticlePool&) = delete;
+
+    ~ParticlePool() { resize(0); }
+
+    // Allocates aCapacity particles up front, or with aGrow starts small
+    // and grows on demand up to aCapacity
+    void init(int aCapacity, bool aGrow)
+    {
+        max_capacity = aCapacity;
+        resize(aGrow ? std::min(aCapacity, PARTICLE_POOL_INITIAL) : aCapacity);
+    }
+
+    bool spawn(const Particle& p)
+    {
+        if (count == capacity)
+        {
+            if (capacity == max_capacity)
+            {
+                dropped++;
+                return false;
+            }
+            resize(std::min(capacity * 2, max_capacity));
+        }
+        store(count++, p);
+        if (count > peak)
+            peak = count;
+        return true;
+    }
+
+    // Appends up to n particles, growing the pool if allowed, and returns
+    // how many were added; they start at the old count and are left for the
+    // caller to fill. Any that don't fit count as dropped.
+    int append(int n)
+    {
+        int needed = count + n;
+        if (needed > capacity && capacity < max_capacity)
+        {
+            int grown = std::max(capacity, 1);
+            while (grown < needed && grown < max_capacity)
+                grown *= 2;
+            resize(std::min(grown, max_capacity));
+        }
+        int added = std::min(n, capacity - count);
+        dropped += n - added;
+        count += added;
+        if (count > peak)
+            peak = count;
+        return added;
+    }
+
+    // Swap-remove; the caller must revisit slot i, which now holds what was
+    // the last particle.
+    void kill(int i)
+    {
+        count--;
+        move(count, i);
+    }
+
+    void remove_dead()
+    {
+        for (int i = 0; i < count;)
+        {
+            if (live[i] > 0)
+                i++;
+            else
+                kill(i);
+        }
+    }
+
+    void move(int from, int to)
+    {
+        x[to] = x[from];
+        y[to] = y[from];
+        xi[to] = xi[from];
+        yi[to] = yi[from];
+        live[to] = live[from];
+        gen[to] = gen[from];
+        color[to] = color[from];
+    }
+
+    void report(const char* aName) const
+    {
+        std::cout << aName << ": peak " << peak << " / " << max_capacity << ", dropped "
+                  << dropped << "\n";
+    }
+
+    void store(int i, const Particle& p)
+    {
+        x[i] = p.x;
+        y[i] = p.y;
+        xi[i] = p.xi;
+        yi[i] = p.yi;
+        live[i] = p.live;
+        gen[i] = p.gen;
+        color[i] = p.color;
+    }
+
+private:
+    template <typename T>
+    void resize_array(T*& a, int aCapacity)
+    {
+        T* n = aCapacity ? alloc_aligned<T>(aCapacity) : nullptr;
+        if (n && a)
+            std::copy(a, a + count, n);
+        free_aligned(a);
+        a = n;
+    }
+
+    void resize(int aCapacity)
+    {
+        count = std::min(count, aCapacity);
+        resize_array(x, aCapacity);
+        resize_array(y, aCapacity);
+        resize_array(xi, aCapacity);
+        resize_array(yi, aCapacity);
+        resize_array(live, aCapacity);
+        resize_array(gen, aCapacity);
+        resize_array(color, aCapacity);
+        capacity = aCapacity;
+    }
+};
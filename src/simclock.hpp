@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// Fixed timestep simulation clock.
+// Real time is fed in once per frame and paid out in whole steps. At most
+// max_substeps steps are run per frame; when the simulation falls further
+// behind than that (a stall, a slow machine, the first frame) the excess is
+// dropped and the simulation runs slower than real time instead of trying to
+// catch up. alpha is how far real time is into the next step, for rendering
+// between the last two simulated states.
+struct SimClock
+{
+    // Milliseconds per step
+    uint64_t step = 20;
+    int max_substeps = 4;
+
+    // Simulated time, advanced by step for every tick run
+    uint64_t time = 0;
+    // 0..1, fraction of a step not yet simulated
+    float alpha = 0;
+    // Total real time dropped because of the substep limit
+    uint64_t dilated = 0;
+
+    // Returns the number of steps to simulate this frame
+    int advance(uint64_t aNow)
+    {
+        if (!started)
+        {
+            last = aNow;
+            started = true;
+        }
+        accumulator += aNow - last;
+        last = aNow;
+
+        uint64_t steps = accumulator / step;
+        if (steps > (uint64_t) max_substeps)
+        {
+            // Drop the whole steps past the limit, keep the part step
+            dilated += (steps - max_substeps) * step;
+            steps = max_substeps;
+            accumulator %= step;
+        }
+        else
+            accumulator -= steps * step;
+        alpha = (float) accumulator / (float) step;
+        return (int) steps;
+    }
+
+private:
+    bool started = false;
+    uint64_t last = 0;
+    uint64_t accumulator = 0;
+};
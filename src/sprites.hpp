@@ -1,5 +1,5 @@
 // clang-format off
-const unsigned char sprite[] =
+constexpr unsigned char sprite[] =
     {
         0,0,0,0,0,1,0,1,0,1,0,0,0,0,0,0,
         0,0,0,1,0,1,0,1,0,1,0,1,0,0,0,0,
@@ -20,16 +20,10 @@ const unsigned char sprite[] =
     };
 // clang-format on
 
-void drawsprite(int x, int y, unsigned int color)
-{
-    int i, j, c, yofs;
-    yofs = y * WINDOW_WIDTH + x;
-    for (i = 0, c = 0; i < 16; i++)
-    {
-        for (j = 0; j < 16; j++, c++)
-            if (sprite[c])
-                G.framebuffer[yofs + j] = color;
+constexpr CompiledMask<16, 16> gSpriteMask(sprite);
 
-        yofs += WINDOW_WIDTH;
-    }
+template <typename Blend = BlendReplace>
+void drawsprite(int x, int y, unsigned int color, const ClipRect& clip = SCREEN_CLIP)
+{
+    blit_mask<Blend>(G.framebuffer, WINDOW_WIDTH, clip, x, y, gSpriteMask, (int) color);
 }
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "blend.hpp"
+#include "tiles.hpp"
+
+// Span length of every row of a radius r circle, rows 0 .. 2r - 1:
+// (int) (sqrt(r * r - (r - i) * (r - i)) * 2), the per-row math of the
+// drawcircle family, computed once per radius on first use. Row i is
+// centred on the circle, starting at x - len / 2.
+const int* circle_spans(int r)
+{
+    static std::vector<std::vector<int>> cache;
+    if ((int) cache.size() <= r)
+        cache.resize(r + 1);
+    std::vector<int>& spans = cache[r];
+    if (spans.empty())
+    {
+        // one extra entry, so that r = 0 is cached too
+        spans.resize(2 * r + 1);
+        for (int i = 0; i < 2 * r; i++)
+            spans[i] = (int) (sqrt(r * r - (r - i) * (r - i)) * 2);
+    }
+    return spans.data();
+}
+
+// Pre-rasterized circle footprint.
+// Built once per radius from circle_spans, with the spans placed relative to
+// the centre and the extent precomputed for clipping. The footprint doesn't depend on how it
+// is blended: draw_stamp takes the blend operation, and every blend mode
+// shares the one cached stamp per radius.
+struct Stamp
+{
+    int r = 0;
+    // Row i covers y - r + i; span offset from the centre and length
+    std::vector<int> xofs;
+    std::vector<int> len;
+    // Horizontal extent relative to the centre, right exclusive
+    int left = 0;
+    int right = 0;
+};
+
+const Stamp& get_stamp(int r)
+{
+    static std::vector<std::unique_ptr<Stamp>> cache;
+    if ((int) cache.size() <= r)
+        cache.resize(r + 1);
+    if (!cache[r])
+    {
+        auto s = std::make_unique<Stamp>();
+        s->r = r;
+        const int* spans = circle_spans(r);
+        for (int i = 0; i < 2 * r; i++)
+        {
+            int len = spans[i];
+            s->xofs.push_back(-len / 2);
+            s->len.push_back(len);
+            s->left = std::min(s->left, -len / 2);
+            s->right = std::max(s->right, -len / 2 + len);
+        }
+        cache[r] = std::move(s);
+    }
+    return *cache[r];
+}
+
+// Stamp s centred at (x, y) into a framebuffer of row length pitch, with a
+// blend policy (see blend.hpp). Only pixels inside clip are written. Clipping
+// is decided once for the whole stamp: stamps fully inside the clip rect
+// (nearly all of them) run without any per-row checks.
+template <typename Blend>
+void draw_stamp(int* fb, int pitch, const ClipRect& clip, const Stamp& s, int x, int y, int c)
+{
+    const int rows = 2 * s.r;
+    const int top = y - s.r;
+    if (x + s.right <= clip.x0 || x + s.left >= clip.x1 || top + rows <= clip.y0
+        || top >= clip.y1)
+        return;
+
+    if (x + s.left >= clip.x0 && x + s.right <= clip.x1 && top >= clip.y0
+        && top + rows <= clip.y1)
+    {
+        int* row = fb + top * pitch + x;
+        for (int i = 0; i < rows; i++, row += pitch)
+            blend_fill<Blend>(row + s.xofs[i], c, s.len[i]);
+        return;
+    }
+
+    const int first = std::max(0, clip.y0 - top);
+    const int last = std::min(rows, clip.y1 - top);
+    for (int i = first; i < last; i++)
+    {
+        int x0 = std::max(x + s.xofs[i], clip.x0);
+        int x1 = std::min(x + s.xofs[i] + s.len[i], clip.x1);
+        if (x1 > x0)
+            blend_fill<Blend>(fb + (top + i) * pitch + x0, c, x1 - x0);
+    }
+}
+
+// Anti-aliased circle footprint: the fully covered spans of each row as in
+// Stamp, plus the partly covered pixels at both ends with their coverage.
+// Coverage is measured once per radius by supersampling each pixel of the
+// 2r x 2r box against a circle centred on the corner between the four middle
+// pixels, so drawing needs no distance math.
+struct AaStamp : Stamp
+{
+    struct Edge
+    {
+        // Offset from the centre, coverage 1 .. 255 of 256
+        int dx;
+        int cover;
+    };
+    // Partly covered pixels of row i are edge[first[i] .. first[i + 1])
+    std::vector<Edge> edge;
+    std::vector<int> first;
+};
+
+const AaStamp& get_aa_stamp(int r)
+{
+    static std::vector<std::unique_ptr<AaStamp>> cache;
+    if ((int) cache.size() <= r)
+        cache.resize(r + 1);
+    if (!cache[r])
+    {
+        constexpr int SAMPLES = 16;
+        auto s = std::make_unique<AaStamp>();
+        s->r = r;
+        s->first.push_back(0);
+        for (int i = 0; i < 2 * r; i++)
+        {
+            int full0 = r, full1 = -r;
+            for (int dx = -r; dx < r; dx++)
+            {
+                int inside = 0;
+                for (int sy = 0; sy < SAMPLES; sy++)
+                    for (int sx = 0; sx < SAMPLES; sx++)
+                    {
+                        float px = dx + (sx + 0.5f) / SAMPLES;
+                        float py = i - r + (sy + 0.5f) / SAMPLES;
+                        inside += px * px + py * py < (float) (r * r);
+                    }
+                int cover = inside * 256 / (SAMPLES * SAMPLES);
+                if (cover == 256)
+                {
+                    full0 = std::min(full0, dx);
+                    full1 = std::max(full1, dx + 1);
+                }
+                else if (cover > 0)
+                {
+                    s->edge.push_back({ dx, cover });
+                    s->left = std::min(s->left, dx);
+                    s->right = std::max(s->right, dx + 1);
+                }
+            }
+            // The disc is convex, so the full pixels of a row are contiguous
+            s->xofs.push_back(full1 > full0 ? full0 : 0);
+            s->len.push_back(std::max(full1 - full0, 0));
+            s->left = std::min(s->left, s->xofs.back());
+            s->right = std::max(s->right, s->xofs.back() + s->len.back());
+            s->first.push_back((int) s->edge.size());
+        }
+        cache[r] = std::move(s);
+    }
+    return *cache[r];
+}
+
+// Anti-aliased stamp s centred at (x, y); see draw_stamp. The full spans go
+// through the span kernels, the edge pixels are blended one at a time at
+// their coverage.
+template <typename Blend>
+void draw_aa_stamp(int* fb, int pitch, const ClipRect& clip, const AaStamp& s, int x, int y, int c)
+{
+    const int rows = 2 * s.r;
+    const int top = y - s.r;
+    if (x + s.right <= clip.x0 || x + s.left >= clip.x1 || top + rows <= clip.y0
+        || top >= clip.y1)
+        return;
+
+    draw_stamp<Blend>(fb, pitch, clip, s, x, y, c);
+
+    if (x + s.left >= clip.x0 && x + s.right <= clip.x1 && top >= clip.y0
+        && top + rows <= clip.y1)
+    {
+        int* row = fb + top * pitch + x;
+        for (int i = 0; i < rows; i++, row += pitch)
+            for (int k = s.first[i]; k < s.first[i + 1]; k++)
+                row[s.edge[k].dx] = blend_cover<Blend>(row[s.edge[k].dx], c, s.edge[k].cover);
+        return;
+    }
+
+    const int first = std::max(0, clip.y0 - top);
+    const int last = std::min(rows, clip.y1 - top);
+    for (int i = first; i < last; i++)
+    {
+        // Indexed from the row start: column x itself may be off screen
+        int* row = fb + (top + i) * pitch;
+        for (int k = s.first[i]; k < s.first[i + 1]; k++)
+        {
+            const int px = x + s.edge[k].dx;
+            if (px >= clip.x0 && px < clip.x1)
+                row[px] = blend_cover<Blend>(row[px], c, s.edge[k].cover);
+        }
+    }
+}
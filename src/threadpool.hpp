@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for data-parallel loops.
+// run(jobs, job) calls job(0) .. job(jobs - 1) spread across the workers and
+// the calling thread, and returns once all of them have finished. Which thread
+// runs which index is not fixed, so jobs must only write state owned by their
+// index.
+class WorkerPool
+{
+public:
+    // aThreads extra threads; 0 runs everything on the calling thread
+    explicit WorkerPool(int aThreads)
+    {
+        for (int i = 0; i < aThreads; i++)
+            threads.emplace_back([this] { work(); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    int size() const { return (int) threads.size() + 1; }
+
+    void run(int aJobs, std::function<void(int)> aJob)
+    {
+        if (threads.empty() || aJobs <= 1)
+        {
+            for (int i = 0; i < aJobs; i++)
+                aJob(i);
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // A worker that woke late may still be draining the previous run
+            idle.wait(lock, [this] { return busy == 0; });
+            job = std::move(aJob);
+            jobs = aJobs;
+            pending = aJobs;
+            next = 0;
+            generation++;
+            busy++;
+        }
+        wake.notify_all();
+
+        drain();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    void work()
+    {
+        unsigned int seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if (quit)
+                    return;
+                seen = generation;
+                busy++;
+            }
+            drain();
+        }
+    }
+
+    // Caller has already counted itself in busy
+    void drain()
+    {
+        for (;;)
+        {
+            int i = next.fetch_add(1);
+            if (i >= jobs)
+                break;
+            job(i);
+            pending.fetch_sub(1);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        busy--;
+        idle.notify_all();
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::function<void(int)> job;
+    std::atomic<int> next { 0 };
+    std::atomic<int> pending { 0 };
+    int jobs = 0;
+    int busy = 0;
+    unsigned int generation = 0;
+    bool quit = false;
+};
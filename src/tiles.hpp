@@ -0,0 +1,23 @@
+#pragma once
+
+#include <algorithm>
+
+// Screen tiles. Drawing everything that lands in one tile before moving on
+// keeps that tile's framebuffer rows in L1/L2 (64 rows of 256 bytes).
+constexpr int TILE_SHIFT = 6;
+constexpr int TILE_SIZE = 1 << TILE_SHIFT;
+
+// Half-open pixel rectangle [x0, x1) x [y0, y1) that a rasterizer may write
+struct ClipRect
+{
+    int x0, y0, x1, y1;
+};
+
+// Tile t of a w x h screen, cut to the screen edge
+ClipRect tile_rect(int t, int w, int h)
+{
+    const int tw = (w + TILE_SIZE - 1) >> TILE_SHIFT;
+    const int x0 = (t % tw) << TILE_SHIFT;
+    const int y0 = (t / tw) << TILE_SHIFT;
+    return { x0, y0, std::min(x0 + TILE_SIZE, w), std::min(y0 + TILE_SIZE, h) };
+}
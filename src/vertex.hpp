@@ -0,0 +1,383 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "aligned.hpp"
+#include "cpu.hpp"
+#include "rng.hpp"
+#include "tiles.hpp"
+
+// Vertex structure
+struct Vertex
+{
+    float x, y, z;
+};
+
+// Row-major 3x3 matrix. Rotations follow the right-hand rule (rotate_z
+// turns +x towards +y) and compose like the transforms they stand for:
+// a * b applies b first.
+struct Mat3
+{
+    float m[3][3];
+
+    static Mat3 identity() { return { { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } } }; }
+
+    static Mat3 rotate_x(double angle)
+    {
+        float ca = (float) cos(angle), sa = (float) sin(angle);
+        return { { { 1, 0, 0 }, { 0, ca, -sa }, { 0, sa, ca } } };
+    }
+
+    static Mat3 rotate_y(double angle)
+    {
+        float ca = (float) cos(angle), sa = (float) sin(angle);
+        return { { { ca, 0, sa }, { 0, 1, 0 }, { -sa, 0, ca } } };
+    }
+
+    static Mat3 rotate_z(double angle)
+    {
+        float ca = (float) cos(angle), sa = (float) sin(angle);
+        return { { { ca, -sa, 0 }, { sa, ca, 0 }, { 0, 0, 1 } } };
+    }
+
+    Mat3 operator*(const Mat3& b) const
+    {
+        Mat3 r;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                r.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+        return r;
+    }
+};
+
+// Vertices as separate x, y and z arrays, so SIMD kernels load whole
+// vectors of one coordinate without shuffles. The arrays are 64-byte aligned
+// and padded with zeros to a multiple of VERTEX_PAD, so transforms run whole
+// vectors past count without a tail.
+constexpr int VERTEX_PAD = 16;
+
+class VertexBuffer
+{
+public:
+    float* x = nullptr;
+    float* y = nullptr;
+    float* z = nullptr;
+    int count = 0;
+    // count rounded up to VERTEX_PAD
+    int padded = 0;
+
+    VertexBuffer() = default;
+    VertexBuffer(const VertexBuffer&) = delete;
+    VertexBuffer& operator=(const VertexBuffer&) = delete;
+    ~VertexBuffer() { resize(0); }
+
+    // Contents are zeroed
+    void resize(int n)
+    {
+        free_aligned(x);
+        free_aligned(y);
+        free_aligned(z);
+        count = n;
+        padded = (n + VERTEX_PAD - 1) / VERTEX_PAD * VERTEX_PAD;
+        x = padded ? alloc_aligned<float>(padded) : nullptr;
+        y = padded ? alloc_aligned<float>(padded) : nullptr;
+        z = padded ? alloc_aligned<float>(padded) : nullptr;
+        std::fill(x, x + padded, 0.0f);
+        std::fill(y, y + padded, 0.0f);
+        std::fill(z, z + padded, 0.0f);
+    }
+
+    // From / to an array of Vertex
+    void load(const Vertex* v, int n)
+    {
+        if (n != count)
+            resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            x[i] = v[i].x;
+            y[i] = v[i].y;
+            z[i] = v[i].z;
+        }
+    }
+
+    void store(Vertex* v) const
+    {
+        for (int i = 0; i < count; i++)
+            v[i] = { x[i], y[i], z[i] };
+    }
+};
+
+// out = m * in, vertex by vertex, over the whole padded buffer; out is
+// resized to match. The SIMD kernels do the same multiplies and adds in the
+// same order, so all tiers give identical results.
+void transform_scalar(const Mat3& m, const VertexBuffer& in, VertexBuffer& out)
+{
+    for (int i = 0; i < in.padded; i++)
+    {
+        const float x = in.x[i], y = in.y[i], z = in.z[i];
+        out.x[i] = m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z;
+        out.y[i] = m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z;
+        out.z[i] = m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z;
+    }
+}
+
+#if defined(CPU_HAVE_SSE2)
+void transform_sse2(const Mat3& m, const VertexBuffer& in, VertexBuffer& out)
+{
+    __m128 r[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            r[i][j] = _mm_set1_ps(m.m[i][j]);
+    for (int i = 0; i < in.padded; i += 4)
+    {
+        const __m128 x = _mm_load_ps(in.x + i), y = _mm_load_ps(in.y + i);
+        const __m128 z = _mm_load_ps(in.z + i);
+        float* dst[3] = { out.x + i, out.y + i, out.z + i };
+        for (int k = 0; k < 3; k++)
+        {
+            __m128 v = _mm_add_ps(_mm_mul_ps(r[k][0], x), _mm_mul_ps(r[k][1], y));
+            _mm_store_ps(dst[k], _mm_add_ps(v, _mm_mul_ps(r[k][2], z)));
+        }
+    }
+}
+#endif
+
+#if defined(CPU_HAVE_AVX2)
+TARGET_AVX2 void transform_avx2(const Mat3& m, const VertexBuffer& in, VertexBuffer& out)
+{
+    __m256 r[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            r[i][j] = _mm256_set1_ps(m.m[i][j]);
+    for (int i = 0; i < in.padded; i += 8)
+    {
+        const __m256 x = _mm256_load_ps(in.x + i), y = _mm256_load_ps(in.y + i);
+        const __m256 z = _mm256_load_ps(in.z + i);
+        float* dst[3] = { out.x + i, out.y + i, out.z + i };
+        for (int k = 0; k < 3; k++)
+        {
+            __m256 v = _mm256_add_ps(_mm256_mul_ps(r[k][0], x), _mm256_mul_ps(r[k][1], y));
+            _mm256_store_ps(dst[k], _mm256_add_ps(v, _mm256_mul_ps(r[k][2], z)));
+        }
+    }
+}
+#endif
+
+void transform_vertices(const Mat3& m, const VertexBuffer& in, VertexBuffer& out)
+{
+    if (out.count != in.count)
+        out.resize(in.count);
+    switch (gCpuTier)
+    {
+#if defined(CPU_HAVE_AVX2)
+    case TIER_AVX2:
+        return transform_avx2(m, in, out);
+#endif
+#if defined(CPU_HAVE_SSE2)
+    case TIER_SSE2:
+        return transform_sse2(m, in, out);
+#endif
+    default:
+        return transform_scalar(m, in, out);
+    }
+}
+
+// Pinhole camera on the z axis at z = -distance, looking towards +z, with
+// the image centred on (cx, cy)
+struct Camera
+{
+    float distance;
+    float focal;
+    float cx, cy;
+    // Vertices with depth (z + distance) up to this are culled
+    float near;
+};
+
+// Perspective projection of v[begin .. count) with culling. Vertices in
+// front of the near plane whose image lands inside clip are written, in
+// order, as pixel x, y and depth; returns how many. The SIMD kernels round
+// exactly like the scalar one (true division, truncation), so all give the
+// same points. Padding is never projected.
+int project_scalar(const VertexBuffer& v,
+                   const Camera& cam,
+                   const ClipRect& clip,
+                   int* x,
+                   int* y,
+                   float* depth,
+                   int begin = 0)
+{
+    int k = 0;
+    for (int i = begin; i < v.count; i++)
+    {
+        const float d = v.z[i] + cam.distance;
+        if (!(d > cam.near))
+            continue;
+        const float s = cam.focal / d;
+        const float fx = cam.cx + v.x[i] * s;
+        const float fy = cam.cy + v.y[i] * s;
+        if (fx >= clip.x0 && fx < clip.x1 && fy >= clip.y0 && fy < clip.y1)
+        {
+            x[k] = (int) fx;
+            y[k] = (int) fy;
+            depth[k] = d;
+            k++;
+        }
+    }
+    return k;
+}
+
+#if defined(CPU_HAVE_SSE2)
+int project_sse2(const VertexBuffer& v,
+                 const Camera& cam,
+                 const ClipRect& clip,
+                 int* x,
+                 int* y,
+                 float* depth)
+{
+    const __m128 dist = _mm_set1_ps(cam.distance), focal = _mm_set1_ps(cam.focal);
+    const __m128 cx = _mm_set1_ps(cam.cx), cy = _mm_set1_ps(cam.cy);
+    const __m128 near = _mm_set1_ps(cam.near);
+    const __m128 x0 = _mm_set1_ps((float) clip.x0), x1 = _mm_set1_ps((float) clip.x1);
+    const __m128 y0 = _mm_set1_ps((float) clip.y0), y1 = _mm_set1_ps((float) clip.y1);
+    alignas(16) int ix[4], iy[4];
+    alignas(16) float dz[4];
+    int k = 0;
+    int i = 0;
+    for (; i + 4 <= v.count; i += 4)
+    {
+        __m128 d = _mm_add_ps(_mm_load_ps(v.z + i), dist);
+        __m128 s = _mm_div_ps(focal, d);
+        __m128 fx = _mm_add_ps(cx, _mm_mul_ps(_mm_load_ps(v.x + i), s));
+        __m128 fy = _mm_add_ps(cy, _mm_mul_ps(_mm_load_ps(v.y + i), s));
+        __m128 in = _mm_cmpgt_ps(d, near);
+        in = _mm_and_ps(in, _mm_and_ps(_mm_cmpge_ps(fx, x0), _mm_cmplt_ps(fx, x1)));
+        in = _mm_and_ps(in, _mm_and_ps(_mm_cmpge_ps(fy, y0), _mm_cmplt_ps(fy, y1)));
+        int mask = _mm_movemask_ps(in);
+        if (!mask)
+            continue;
+
+        _mm_store_si128((__m128i*) ix, _mm_cvttps_epi32(fx));
+        _mm_store_si128((__m128i*) iy, _mm_cvttps_epi32(fy));
+        _mm_store_ps(dz, d);
+        for (int j = 0; j < 4; j++)
+            if (mask & (1 << j))
+            {
+                x[k] = ix[j];
+                y[k] = iy[j];
+                depth[k] = dz[j];
+                k++;
+            }
+    }
+    return k + project_scalar(v, cam, clip, x + k, y + k, depth + k, i);
+}
+#endif
+
+#if defined(CPU_HAVE_AVX2)
+TARGET_AVX2 int project_avx2(const VertexBuffer& v,
+                             const Camera& cam,
+                             const ClipRect& clip,
+                             int* x,
+                             int* y,
+                             float* depth)
+{
+    const __m256 dist = _mm256_set1_ps(cam.distance), focal = _mm256_set1_ps(cam.focal);
+    const __m256 cx = _mm256_set1_ps(cam.cx), cy = _mm256_set1_ps(cam.cy);
+    const __m256 near = _mm256_set1_ps(cam.near);
+    const __m256 x0 = _mm256_set1_ps((float) clip.x0), x1 = _mm256_set1_ps((float) clip.x1);
+    const __m256 y0 = _mm256_set1_ps((float) clip.y0), y1 = _mm256_set1_ps((float) clip.y1);
+    alignas(32) int ix[8], iy[8];
+    alignas(32) float dz[8];
+    int k = 0;
+    int i = 0;
+    for (; i + 8 <= v.count; i += 8)
+    {
+        __m256 d = _mm256_add_ps(_mm256_load_ps(v.z + i), dist);
+        __m256 s = _mm256_div_ps(focal, d);
+        __m256 fx = _mm256_add_ps(cx, _mm256_mul_ps(_mm256_load_ps(v.x + i), s));
+        __m256 fy = _mm256_add_ps(cy, _mm256_mul_ps(_mm256_load_ps(v.y + i), s));
+        __m256 in = _mm256_cmp_ps(d, near, _CMP_GT_OQ);
+        in = _mm256_and_ps(in, _mm256_cmp_ps(fx, x0, _CMP_GE_OQ));
+        in = _mm256_and_ps(in, _mm256_cmp_ps(fx, x1, _CMP_LT_OQ));
+        in = _mm256_and_ps(in, _mm256_cmp_ps(fy, y0, _CMP_GE_OQ));
+        in = _mm256_and_ps(in, _mm256_cmp_ps(fy, y1, _CMP_LT_OQ));
+        int mask = _mm256_movemask_ps(in);
+        if (!mask)
+            continue;
+
+        _mm256_store_si256((__m256i*) ix, _mm256_cvttps_epi32(fx));
+        _mm256_store_si256((__m256i*) iy, _mm256_cvttps_epi32(fy));
+        _mm256_store_ps(dz, d);
+        for (int j = 0; j < 8; j++)
+            if (mask & (1 << j))
+            {
+                x[k] = ix[j];
+                y[k] = iy[j];
+                depth[k] = dz[j];
+                k++;
+            }
+    }
+    return k + project_scalar(v, cam, clip, x + k, y + k, depth + k, i);
+}
+#endif
+
+int project_vertices(
+    const VertexBuffer& v, const Camera& cam, const ClipRect& clip, int* x, int* y, float* depth)
+{
+    switch (gCpuTier)
+    {
+#if defined(CPU_HAVE_AVX2)
+    case TIER_AVX2:
+        return project_avx2(v, cam, clip, x, y, depth);
+#endif
+#if defined(CPU_HAVE_SSE2)
+    case TIER_SSE2:
+        return project_sse2(v, cam, clip, x, y, depth);
+#endif
+    default:
+        return project_scalar(v, cam, clip, x, y, depth);
+    }
+}
+
+// Runs the selected tier's transform and projection and the scalar
+// reference over the same random vertices and compares the results bit for
+// bit. The vertices fill a box around the camera, so some are behind the
+// near plane and some project outside clip.
+bool vertex_matches_scalar()
+{
+    constexpr int n = SELFTEST_COUNT;
+    const Camera cam = { 400, 486, 480, 270, 1 };
+    const ClipRect clip = { 0, 0, 960, 540 };
+    const Mat3 m = Mat3::rotate_x(0.3) * Mat3::rotate_y(0.5) * Mat3::rotate_z(0.7);
+    Vertex v[n];
+    Rng rng(1);
+    for (int i = 0; i < n; i++)
+    {
+        const float x = rng.uniform(), y = rng.uniform(), z = rng.uniform();
+        v[i] = { x * 1200 - 600, y * 1200 - 600, z * 1200 - 600 };
+    }
+
+    VertexBuffer in, ref, out;
+    in.load(v, n);
+    ref.resize(n);
+    transform_scalar(m, in, ref);
+    transform_vertices(m, in, out);
+    const size_t bytes = sizeof(float) * ref.padded;
+    if (memcmp(out.x, ref.x, bytes) != 0 || memcmp(out.y, ref.y, bytes) != 0
+        || memcmp(out.z, ref.z, bytes) != 0)
+        return false;
+
+    int rx[n], ry[n], x[n], y[n];
+    float rdepth[n], depth[n];
+    const int k = project_scalar(ref, cam, clip, rx, ry, rdepth);
+    return project_vertices(ref, cam, clip, x, y, depth) == k
+           && memcmp(x, rx, sizeof(int) * k) == 0 && memcmp(y, ry, sizeof(int) * k) == 0
+           && memcmp(depth, rdepth, sizeof(float) * k) == 0;
+}
+
+bool vertex_selftest()
+{
+    return for_each_supported_tier("transform / project", vertex_matches_scalar);
+}